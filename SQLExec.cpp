@@ -11,12 +11,11 @@ using namespace hsql;
 Tables *SQLExec::tables = nullptr;
 Indices *SQLExec::indices = nullptr;
 
-QueryResult *SQLExec::create_index(const CreateStatement *statement) {
+QueryResult *SQLExec::create_index(const CreateStatement *statement, const ColumnNames *include_columns) {
     Identifier index_name = statement->indexName;
     Identifier table_name = statement->tableName;
     Identifier index_type;
-    bool is_unique = false;
-
+    bool is_unique = false;  // until the grammar has CREATE UNIQUE INDEX to ask for it
 
     try {
         index_type = statement->indexType;
@@ -24,9 +23,13 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
         index_type = "BTREE";
     }
 
-    if (index_type == "BTREE") {
-        is_unique = true;
-    }
+    if (include_columns != nullptr && !include_columns->empty() && index_type != "BTREE")
+        throw SQLExecError("only BTREE indices can have included columns");
+    if (index_type != "BTREE" && index_type != "HASH" && index_type != "ART")
+        throw SQLExecError("unknown index type " + index_type);
+    if (statement->indexColumns->size() + (include_columns == nullptr ? 0 : include_columns->size())
+            > DbIndex::MAX_COMPOSITE)
+        throw SQLExecError("an index can have at most " + to_string(DbIndex::MAX_COMPOSITE) + " columns");
 
     ValueDict row;
     Handles cHandles;
@@ -44,30 +47,49 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
             Handle indexHandle = indices->insert(&row);
             cHandles.push_back(indexHandle);
         }
+        if (include_columns != nullptr) {
+            // included columns are numbered -1, -2, ...
+            row["seq_in_index"] = 0;
+            for (auto const &col: *include_columns) {
+                row["seq_in_index"].n -= 1;
+                row["column_name"] = col;
+                cHandles.push_back(indices->insert(&row));
+            }
+        }
         DbIndex &index = indices->get_index(table_name, index_name);
         index.create();
     } catch (SQLExecError &e) {
         for (auto const &handle: cHandles) {
             indices->del(handle);
         }
+    } catch (DbRelationError &e) {
+        // e.g., a unique index over duplicate values; don't leave it in _indices
+        for (auto const &handle: cHandles) {
+            indices->del(handle);
+        }
+        throw;
     }
 
     return new QueryResult("created index " + index_name);
 }
 
 QueryResult *SQLExec::drop_index(const DropStatement *statement) {
+    Identifier table_name = statement->name;
+    Identifier index_name = statement->indexName;
 
-    /*
-         """ Drop the index. """
-        index = Schema.indices.get_index(self.table_name, self.index_name)
-        where = {'table_name': self.table_name, 'index_name': self.index_name}
-        for handle in Schema.indices.select(where):
-            Schema.indices.delete(handle)
-        index.drop()
-        Schema.indices.remove_from_cache(self.table_name, self.index_name)
-        return None, None, None, 'dropped index ' + self.index_name
-     * */
-    return new QueryResult("drop index not implemented");  // FIXME
+    // drop the index itself before its _indices rows go (that's when the DbIndex is deleted)
+    DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
+    index.drop();
+
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    where["index_name"] = Value(index_name);
+    Handles *handles = SQLExec::indices->select(&where);
+    for (auto const &handle: *handles)
+        SQLExec::indices->del(handle);
+    delete handles;
+
+    return new QueryResult("dropped index " + index_name);
 }
 
 QueryResult *SQLExec::show_index(const ShowStatement *statement) {
@@ -90,22 +112,44 @@ QueryResult *SQLExec::show_index(const ShowStatement *statement) {
 
     whereClause["table_name"] = Value(statement->tableName);
 
-    Handles* indexHandles = indices->select(&whereClause);
-    unsigned numRows = indexHandles->size();
-    ValueDicts* indexRows = new ValueDicts();
-
-    for(auto const& handle:*indexHandles){
-        ValueDict* indexStat = indices->project(handle,column_names);
+    Rows* indexRows = new Rows();
+    ColumnOrdinals ordinals = indices->column_ordinals(column_names);
+    indices->scan(&whereClause, ordinals, [indexRows](Handle handle, const Row& row) {
+        Row* indexStat = new Row(row);
+        indexStat->own();
         indexRows->push_back(indexStat);
-
-    }
-    delete indexHandles;
+    });
+    unsigned numRows = indexRows->size();
 
     return new QueryResult(column_names, col_attributes, indexRows,
                            "successfully returned " + to_string(numRows) + " rows");  // FIXME
 }
 
-ostream &operator<<(ostream &out, const QueryResult &qres) {
+static void print_row(ostream &out, const Row &row) {
+    for (uint i = 0; i < row.size(); i++) {
+        if (row.is_null(i)) {
+            out << "NULL ";
+            continue;
+        }
+        switch (row.get_data_type(i)) {
+            case ColumnAttribute::INT:
+                out << row.get_int(i);
+                break;
+            case ColumnAttribute::TEXT:
+                out << "\"" << row.get_text(i) << "\"";
+                break;
+            case ColumnAttribute::BOOLEAN:
+                out << (row.get_int(i) == 0 ? "false" : "true");
+                break;
+            default:
+                out << "???";
+        }
+        out << " ";
+    }
+    out << endl;
+}
+
+ostream &operator<<(ostream &out, QueryResult &qres) {
     if (qres.column_names != nullptr) {
         for (auto const &column_name: *qres.column_names)
             out << column_name << " ";
@@ -113,26 +157,27 @@ ostream &operator<<(ostream &out, const QueryResult &qres) {
         for (unsigned int i = 0; i < qres.column_names->size(); i++)
             out << "----------+";
         out << endl;
-        for (auto const &row: *qres.rows) {
-            for (auto const &column_name: *qres.column_names) {
-                Value value = row->at(column_name);
-                switch (value.data_type) {
-                    case ColumnAttribute::INT:
-                        out << value.n;
-                        break;
-                    case ColumnAttribute::TEXT:
-                        out << "\"" << value.s << "\"";
-                        break;
-                    case ColumnAttribute::BOOLEAN:
-                        out << (value.n == 0 ? "false" : "true");
-                        break;
-                    default:
-                        out << "???";
-                }
-                out << " ";
+        if (qres.rows != nullptr)
+            for (auto const &row: *qres.rows)
+                print_row(out, *row);
+    }
+    if (qres.scan != nullptr) {
+        // print each row as soon as the scan finds it; this runs after execute has returned, so
+        // storage errors are translated here instead
+        u_long n = 0;
+        Handle handle;
+        try {
+            while (qres.scan->next(handle)) {
+                Row *row = qres.table->project_row(handle, qres.ordinals);
+                print_row(out, *row);
+                delete row;
+                n++;
             }
-            out << endl;
+        } catch (DbRelationError &e) {
+            throw SQLExecError(string("DbRelationError: ") + e.what());
         }
+        out << "successfully returned " << n << " rows";
+        return out;
     }
     out << qres.message;
     return out;
@@ -148,10 +193,11 @@ QueryResult::~QueryResult() {
             delete row;
         delete rows;
     }
+    delete scan;
 }
 
 
-QueryResult *SQLExec::execute(const SQLStatement *statement) throw(SQLExecError) {
+QueryResult *SQLExec::execute(const SQLStatement *statement, const ColumnNames *include_columns) throw(SQLExecError) {
     // initialize _tables table, if not yet present
     if (SQLExec::tables == nullptr)
         SQLExec::tables = new Tables();
@@ -163,11 +209,17 @@ QueryResult *SQLExec::execute(const SQLStatement *statement) throw(SQLExecError)
     try {
         switch (statement->type()) {
             case kStmtCreate:
-                return create((const CreateStatement *) statement);
+                return create((const CreateStatement *) statement, include_columns);
             case kStmtDrop:
                 return drop((const DropStatement *) statement);
             case kStmtShow:
                 return show((const ShowStatement *) statement);
+            case kStmtSelect:
+                return select((const SelectStatement *) statement);
+            case kStmtInsert:
+                return insert((const InsertStatement *) statement);
+            case kStmtDelete:
+                return del((const DeleteStatement *) statement);
             default:
                 return new QueryResult("not implemented");
         }
@@ -192,12 +244,12 @@ void SQLExec::column_definition(const ColumnDefinition *col, Identifier &column_
     }
 }
 
-QueryResult *SQLExec::create(const CreateStatement *statement) {
+QueryResult *SQLExec::create(const CreateStatement *statement, const ColumnNames *include_columns) {
     switch (statement->type) {
         case CreateStatement::kTable:
             return create_table(statement);
         case CreateStatement::kIndex:
-            return create_index(statement);
+            return create_index(statement, include_columns);
         default:
             return new QueryResult("Only CREATE TABLE and CREATE INDEX are implemented");
     }
@@ -279,6 +331,17 @@ QueryResult *SQLExec::drop_table(const DropStatement *statement) {
     // get the table
     DbRelation &table = SQLExec::tables->get_table(table_name);
 
+    // drop its indices
+    for (auto const &index_name: SQLExec::indices->get_index_names(table_name)) {
+        SQLExec::indices->get_index(table_name, index_name).drop();
+        ValueDict index_where = where;
+        index_where["index_name"] = Value(index_name);
+        Handles *handles = SQLExec::indices->select(&index_where);
+        for (auto const &handle: *handles)
+            SQLExec::indices->del(handle);
+        delete handles;
+    }
+
     // remove from _columns schema
     DbRelation &columns = SQLExec::tables->get_table(Columns::TABLE_NAME);
     Handles *handles = columns.select(&where);
@@ -317,17 +380,19 @@ QueryResult *SQLExec::show_tables() {
     ColumnAttributes *column_attributes = new ColumnAttributes;
     column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
 
-    Handles *handles = SQLExec::tables->select();
-    u_long n = handles->size() - 2;
-
-    ValueDicts *rows = new ValueDicts;
-    for (auto const &handle: *handles) {
-        ValueDict *row = SQLExec::tables->project(handle, column_names);
-        Identifier table_name = row->at("table_name").s;
-        if (table_name != Tables::TABLE_NAME && table_name != Columns::TABLE_NAME)
-            rows->push_back(row);
-    }
-    delete handles;
+    u_long n = 0;
+    Rows *rows = new Rows;
+    ColumnOrdinals ordinals = SQLExec::tables->column_ordinals(column_names);
+    SQLExec::tables->scan(nullptr, ordinals, [rows, &n](Handle handle, const Row &row) {
+        TextView table_name = row.get_text(0);
+        if (table_name != Tables::TABLE_NAME && table_name != Columns::TABLE_NAME) {
+            Row *copy = new Row(row);
+            copy->own();
+            rows->push_back(copy);
+        }
+        n++;
+    });
+    n -= 2;
     return new QueryResult(column_names, column_attributes, rows,
                            "successfully returned " + to_string(n) + " rows");
 }
@@ -345,16 +410,178 @@ QueryResult *SQLExec::show_columns(const ShowStatement *statement) {
 
     ValueDict where;
     where["table_name"] = Value(statement->tableName);
-    Handles *handles = columns.select(&where);
-    u_long n = handles->size();
+    Rows *rows = new Rows;
+    ColumnOrdinals ordinals = columns.column_ordinals(column_names);
+    columns.scan(&where, ordinals, [rows](Handle handle, const Row &row) {
+        Row *copy = new Row(row);
+        copy->own();
+        rows->push_back(copy);
+    });
+    u_long n = rows->size();
+    return new QueryResult(column_names, column_attributes, rows,
+                           "successfully returned " + to_string(n) + " rows");
+}
 
-    ValueDicts *rows = new ValueDicts;
-    for (auto const &handle: *handles) {
-        ValueDict *row = columns.project(handle, column_names);
-        rows->push_back(row);
+// SELECT <columns> FROM <table> [WHERE <column> = <literal> AND ...]
+// If an index has all the columns, the rows come from its entries (see covering_index). Otherwise
+// the rows aren't fetched here; they're found and projected one at a time as the result is printed.
+QueryResult *SQLExec::select(const SelectStatement *statement) {
+    if (statement->fromTable->type != kTableName)
+        throw SQLExecError("only know how to select from a single table");
+    Identifier table_name = statement->fromTable->name;
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    if (table.get_column_names().empty())
+        throw SQLExecError("no such table " + table_name);
+
+    ColumnNames *column_names = new ColumnNames;
+    ColumnAttributes *column_attributes = new ColumnAttributes;
+    ValueDict where;
+    ColumnOrdinals ordinals;
+    try {
+        for (Expr *expr: *statement->selectList) {
+            if (expr->type == kExprStar) {
+                for (auto const &column_name: table.get_column_names())
+                    column_names->push_back(column_name);
+            } else if (expr->type == kExprColumnRef) {
+                column_names->push_back(expr->name);
+            } else {
+                throw SQLExecError("only know how to select columns");
+            }
+        }
+        ordinals = table.column_ordinals(column_names);
+        for (auto const &ordinal: ordinals)
+            column_attributes->push_back(table.get_column_attributes()[ordinal]);
+        if (statement->whereClause != nullptr)
+            get_where_conjunction(statement->whereClause, &where);
+    } catch (...) {
+        delete column_names;
+        delete column_attributes;
+        throw;
+    }
+
+    DbIndex *index = covering_index(table, *column_names, where);
+    if (index != nullptr) {
+        Rows *rows = new Rows();
+        try {
+            index->scan(&where, *column_names, [rows](Handle handle, const Row &row) {
+                Row *copy = new Row(row);
+                copy->own();
+                rows->push_back(copy);
+            });
+        } catch (...) {
+            for (auto row: *rows)
+                delete row;
+            delete rows;
+            delete column_names;
+            delete column_attributes;
+            throw;
+        }
+        u_long n = rows->size();
+        return new QueryResult(column_names, column_attributes, rows,
+                               "successfully returned " + to_string(n) + " rows");
+    }
+
+    DbRelationScan *scan = table.open_scan(&where);
+    return new QueryResult(column_names, column_attributes, &table, scan, ordinals);
+}
+
+DbIndex *SQLExec::covering_index(const DbRelation &table, const ColumnNames &column_names, const ValueDict &where) {
+    ColumnNames needed = column_names;
+    for (auto const &column: where)
+        needed.push_back(column.first);
+    DbIndex *best = nullptr;
+    uint best_leading = 0;
+    for (auto index: table.get_indices()) {
+        if (!index->covers(needed))
+            continue;
+        const ColumnNames &key_columns = index->get_key_columns();
+        uint leading = 0;
+        while (leading < key_columns.size() && where.find(key_columns[leading]) != where.end())
+            leading++;
+        if (best == nullptr || leading > best_leading) {
+            best = index;
+            best_leading = leading;
+        }
+    }
+    return best;
+}
+
+// INSERT INTO <table> [(<columns>)] VALUES (<literals>)
+// The table adds the row's entries to its indices, too (or refuses the row if one of them won't take it).
+QueryResult *SQLExec::insert(const InsertStatement *statement) {
+    if (statement->type != InsertStatement::kInsertValues)
+        throw SQLExecError("only know how to insert values");
+    Identifier table_name = statement->tableName;
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    if (table.get_column_names().empty())
+        throw SQLExecError("no such table " + table_name);
+
+    ColumnNames column_names;
+    if (statement->columns == nullptr)
+        column_names = table.get_column_names();
+    else
+        for (auto const &col: *statement->columns)
+            column_names.push_back(col);
+    if (column_names.size() != statement->values->size())
+        throw SQLExecError("number of values doesn't match number of columns");
+    ValueDict row;
+    for (uint i = 0; i < column_names.size(); i++)
+        row[column_names[i]] = get_literal(statement->values->at(i));
+    table.insert(&row);
+
+    u_long n = table.get_indices().size();
+    return new QueryResult("successfully inserted 1 row into " + table_name
+                           + (n == 0 ? "" : " and " + to_string(n) + " indices"));
+}
+
+// DELETE FROM <table> [WHERE <column> = <literal> AND ...]
+// The table takes each row's entries out of its indices, too.
+QueryResult *SQLExec::del(const DeleteStatement *statement) {
+    Identifier table_name = statement->tableName;
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    if (table.get_column_names().empty())
+        throw SQLExecError("no such table " + table_name);
+
+    ValueDict where;
+    if (statement->expr != nullptr)
+        get_where_conjunction(statement->expr, &where);
+    Handles *handles = table.select(&where);
+    u_long n = handles->size();
+    try {
+        for (auto const &handle: *handles)
+            table.del(handle);
+    } catch (...) {
+        delete handles;
+        throw;
     }
     delete handles;
-    return new QueryResult(column_names, column_attributes, rows,
-                           "successfully returned " + to_string(n) + " rows");
+
+    u_long m = table.get_indices().size();
+    return new QueryResult("successfully deleted " + to_string(n) + " rows from " + table_name
+                           + (m == 0 ? "" : " and " + to_string(m) + " indices"));
+}
+
+void SQLExec::get_where_conjunction(const Expr *expr, ValueDict *where) {
+    if (expr->type != kExprOperator)
+        throw SQLExecError("unsupported where clause");
+    if (expr->opType == Expr::AND) {
+        get_where_conjunction(expr->expr, where);
+        get_where_conjunction(expr->expr2, where);
+        return;
+    }
+    if (expr->opType != Expr::SIMPLE_OP || expr->opChar != '=' || expr->expr->type != kExprColumnRef)
+        throw SQLExecError("only know how to do column = literal (AND ...) where clauses");
+    Identifier column_name = expr->expr->name;
+    (*where)[column_name] = get_literal(expr->expr2);
 }
 
+Value SQLExec::get_literal(const Expr *expr) {
+    switch (expr->type) {
+        case kExprLiteralInt:
+            return Value((int32_t) expr->ival);
+        case kExprLiteralString:
+            return Value(string(expr->name));
+        default:
+            throw SQLExecError("unsupported literal");
+    }
+}
@@ -21,30 +21,47 @@ public:
 
 /**
  * @class QueryResult - data structure to hold all the returned data for a query execution
+ * Field i of each row is the column named column_names[i].
+ * The rows are either all there (rows) or are produced one at a time as the result is printed
+ * (scan), in which case the message (how many rows there were) comes at the end.
  */
 class QueryResult {
 public:
-    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), message("") {}
+    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), message(""),
+                    table(nullptr), scan(nullptr), ordinals() {}
 
     QueryResult(std::string message) : column_names(nullptr), column_attributes(nullptr), rows(nullptr),
-                                       message(message) {}
+                                       message(message), table(nullptr), scan(nullptr), ordinals() {}
 
-    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows, std::string message)
-            : column_names(column_names), column_attributes(column_attributes), rows(rows), message(message) {}
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, Rows *rows, std::string message)
+            : column_names(column_names), column_attributes(column_attributes), rows(rows), message(message),
+              table(nullptr), scan(nullptr), ordinals() {}
+
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, DbRelation *table,
+                DbRelationScan *scan, ColumnOrdinals ordinals)
+            : column_names(column_names), column_attributes(column_attributes), rows(nullptr), message(""),
+              table(table), scan(scan), ordinals(ordinals) {}
 
     virtual ~QueryResult();
 
     ColumnNames *get_column_names() const { return column_names; }
     ColumnAttributes *get_column_attributes() const { return column_attributes; }
-    ValueDicts *get_rows() const { return rows; }
+    Rows *get_rows() const { return rows; }
     const std::string &get_message() const { return message; }
-    friend std::ostream &operator<<(std::ostream &stream, const QueryResult &qres);
+    /**
+     * Print the result. A streamed result is consumed as it is printed, and a storage error part
+     * way through it is thrown as an SQLExecError.
+     */
+    friend std::ostream &operator<<(std::ostream &stream, QueryResult &qres);
 
 protected:
     ColumnNames *column_names;
     ColumnAttributes *column_attributes;
-    ValueDicts *rows;
+    Rows *rows;
     std::string message;
+    DbRelation *table;
+    DbRelationScan *scan;
+    ColumnOrdinals ordinals;
 };
 
 
@@ -55,10 +72,13 @@ class SQLExec {
 public:
 	/**
 	 * Execute the given SQL statement.
-	 * @param statement   the Hyrise AST of the SQL statement to execute
-	 * @returns           the query result (freed by caller)
+	 * @param statement        the Hyrise AST of the SQL statement to execute
+	 * @param include_columns  for CREATE INDEX, the columns of its INCLUDE clause, if any (the
+	 *                         parser doesn't know that clause, so the shell takes it off first)
+	 * @returns                the query result (freed by caller)
 	 */
-    static QueryResult *execute(const hsql::SQLStatement *statement) throw(SQLExecError);
+    static QueryResult *execute(const hsql::SQLStatement *statement,
+                                const ColumnNames *include_columns=nullptr) throw(SQLExecError);
 
 protected:
 	// the one place in the system that holds the _tables table and _indices table
@@ -66,9 +86,9 @@ protected:
 	static Indices *indices;
 
 	// recursive decent into the AST
-    static QueryResult *create(const hsql::CreateStatement *statement);
+    static QueryResult *create(const hsql::CreateStatement *statement, const ColumnNames *include_columns);
     static QueryResult *create_table(const hsql::CreateStatement *statement);
-    static QueryResult *create_index(const hsql::CreateStatement *statement);
+    static QueryResult *create_index(const hsql::CreateStatement *statement, const ColumnNames *include_columns);
 
     static QueryResult *drop(const hsql::DropStatement *statement);
     static QueryResult *drop_table(const hsql::DropStatement *statement);
@@ -79,6 +99,38 @@ protected:
     static QueryResult *show_columns(const hsql::ShowStatement *statement);
     static QueryResult *show_index(const hsql::ShowStatement *statement);
 
+    static QueryResult *select(const hsql::SelectStatement *statement);
+
+    static QueryResult *insert(const hsql::InsertStatement *statement);
+    static QueryResult *del(const hsql::DeleteStatement *statement);
+
+	/**
+	 * Pull a where clause of the form: column = literal [AND column = literal ...] apart.
+	 * @param expr   AST of the where clause
+	 * @param where  the column values, added to this
+	 * @throws       SQLExecError for anything more complicated
+	 */
+    static void get_where_conjunction(const hsql::Expr *expr, ValueDict *where);
+
+	/**
+	 * Find an index on the table that has all the columns a query needs, so that the query can be
+	 * answered from the index alone (see DbIndex::scan). If several do, the one whose leading key
+	 * columns the where clause covers the most of (the narrowest scan) wins.
+	 * @param table         the table queried
+	 * @param column_names  the columns selected
+	 * @param where         the where clause
+	 * @returns             the index or nullptr if none will do
+	 */
+    static DbIndex *covering_index(const DbRelation &table, const ColumnNames &column_names, const ValueDict &where);
+
+	/**
+	 * Get the value of a literal.
+	 * @param expr  AST of the literal
+	 * @returns     its value
+	 * @throws      SQLExecError for anything but an INT or TEXT literal
+	 */
+    static Value get_literal(const hsql::Expr *expr);
+
 	/**
 	 * Pull out column name and attributes from AST's column definition clause
 	 * @param col                AST column definition
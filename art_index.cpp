@@ -0,0 +1,718 @@
+/**
+ * @file art_index.cpp - implementation of:
+ * ARTIndex
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#include <memory.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include "art_index.h"
+#include "btree.h"
+#include "heap_storage.h"
+using namespace std;
+
+
+/*
+ * *******************
+ * ARTIndex class
+ * *******************
+ */
+
+ARTIndex::ARTIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique) :
+		DbIndex(relation, name, key_columns, unique), closed(true), root(nullptr), size(0), memory(0),
+		codec(), key_ordinals() {
+	if (this->key_columns.empty() || this->key_columns.size() > MAX_COMPOSITE)
+		throw DbRelationError("index " + name + " must have 1 to " + to_string(MAX_COMPOSITE) + " columns");
+	this->key_ordinals = relation.column_ordinals(&this->key_columns);
+	ColumnAttributes column_attributes = relation.get_column_attributes();
+	ColumnAttributes key_attributes;
+	for (auto ordinal: this->key_ordinals)
+		key_attributes.push_back(column_attributes[ordinal]);
+	this->codec = KeyCodec(key_attributes);
+}
+
+ARTIndex::~ARTIndex() {
+	close();
+}
+
+// There is no file, so creating the index is just building it.
+void ARTIndex::create() {
+	close();
+	open();
+}
+
+void ARTIndex::drop() {
+	close();
+}
+
+// Build the tree from the relation's records. If that fails (e.g., a unique index on values that
+// aren't), the index is left closed.
+void ARTIndex::open() {
+	if (!this->closed)
+		return;
+	this->closed = false;
+	try {
+		this->relation.scan(nullptr, this->key_ordinals, [this](Handle handle, const Row& row) {
+			bool any_null;
+			string key = entry_key(row, handle, &any_null);
+			add(key, any_null);
+		});
+	} catch (...) {
+		close();
+		throw;
+	}
+}
+
+void ARTIndex::close() {
+	free_all(this->root);
+	this->root = nullptr;
+	this->size = 0;
+	this->closed = true;
+}
+
+Handles* ARTIndex::lookup(ValueDict* key_values) const {
+	string key = search_key(key_values);
+	return scan(key, &key);
+}
+
+// Either end can be left off (nullptr) to go from the first key or through the last one.
+Handles* ARTIndex::range(ValueDict* min_key, ValueDict* max_key) const {
+	string from = min_key == nullptr ? "" : search_key(min_key);
+	if (max_key == nullptr)
+		return scan(from, nullptr);
+	string through = search_key(max_key);
+	return scan(from, &through);
+}
+
+// The index is kept up to date only while it is open, so if it isn't, it is built now, from the
+// relation as it is (the record included).
+void ARTIndex::insert(Handle record) {
+	if (this->closed) {
+		open();
+		return;
+	}
+	Row* row = this->relation.project_row(record, this->key_ordinals);
+	bool any_null;
+	string key;
+	try {
+		key = entry_key(*row, record, &any_null);
+	} catch (...) {
+		delete row;
+		throw;
+	}
+	delete row;
+	add(key, any_null);
+}
+
+void ARTIndex::insert_many(const Handles* records) {
+	if (this->closed) {
+		open();
+		return;
+	}
+	DbIndex::insert_many(records);
+}
+
+void ARTIndex::del(Handle record) {
+	open();
+	Row* row = this->relation.project_row(record, this->key_ordinals);
+	string key;
+	try {
+		key = entry_key(*row, record);
+	} catch (...) {
+		delete row;
+		throw;
+	}
+	delete row;
+	if (!remove(this->root, key, 0))
+		throw DbRelationError("record is not in index " + this->name);
+	this->size--;
+}
+
+// A record's key: its key values and its handle.
+string ARTIndex::entry_key(const Row& key_values, Handle record, bool* any_null) const {
+	string key;
+	bool has_null = this->codec.encode(key_values, key);
+	KeyCodec::append_handle(key, record);
+	if (any_null != nullptr)
+		*any_null = has_null;
+	return key;
+}
+
+// What to look for: the given values of the leading key columns.
+string ARTIndex::search_key(const ValueDict* key_values) const {
+	string key;
+	if (this->codec.encode(this->key_columns, key_values, key) == 0)
+		throw DbRelationError("index " + this->name + " needs a value for " + this->key_columns[0]);
+	return key;
+}
+
+// Handles of the keys from the first one not less than from, for as long as the start of the key
+// is not greater than through (or to the end if through is nullptr).
+Handles* ARTIndex::scan(const string& from, const string* through) const {
+	const_cast<ARTIndex*>(this)->open();
+	Handles* handles = new Handles();
+	if (this->root == nullptr)
+		return handles;
+	KeyVisitor visit = [handles](const string& key) {
+		handles->push_back(KeyCodec::get_handle(key.data(), (uint)key.size()));
+		return true;
+	};
+	try {
+		walk(this->root, 0, from, through, true, visit);
+	} catch (...) {
+		delete handles;
+		throw;
+	}
+	return handles;
+}
+
+// Visit the keys under node (which are the same for their first depth bytes) in order. While bounded,
+// they are the same as from so far, and any less than from are skipped. Returns false once a key
+// starts with something greater than through (or visit says to stop).
+bool ARTIndex::walk(const Node* node, uint depth, const string& from, const string* through, bool bounded,
+		KeyVisitor& visit) const {
+	if (node->type == LEAF) {
+		const string& key = ((const Leaf*)node)->key;
+		if (bounded && key.compare(from) < 0)
+			return true;
+		if (through != nullptr && key.compare(0, through->size(), *through) > 0)
+			return false;
+		return visit(key);
+	}
+	const Inner* inner = (const Inner*)node;
+	uint prefix_size = (uint)inner->prefix.size();
+	if (bounded) {
+		uint n = depth < from.size() ? min(prefix_size, (uint)from.size() - depth) : 0;
+		int c = inner->prefix.compare(0, n, from, depth, n);
+		if (c < 0)
+			return true;  // all of them are less than from
+		bounded = c == 0 && n == prefix_size;
+	}
+	depth += prefix_size;
+	uint first = 0;
+	if (bounded && depth < from.size())
+		first = (unsigned char)from[depth];
+	else
+		bounded = false;
+	unsigned char byte;
+	for (uint from_byte = first; from_byte < 256; from_byte = byte + 1U) {
+		const Node* next = next_child(inner, from_byte, byte);
+		if (next == nullptr)
+			break;
+		if (!walk(next, depth + 1, from, through, bounded && byte == first, visit))
+			return false;
+	}
+	return true;
+}
+
+// Check the unique constraint and put the key in.
+void ARTIndex::add(const string& key, bool any_null) {
+	if (this->unique && !any_null) {
+		string values = key.substr(0, key.size() - KeyCodec::HANDLE_SZ);
+		Handles* same = scan(values, &values);
+		bool duplicate = !same->empty();
+		delete same;
+		if (duplicate)
+			throw DbRelationError("duplicate key for unique index " + this->name);
+	}
+	add(this->root, key, 0);
+	this->size++;
+}
+
+// Put the key in under node, which has keys that are the same as it for their first depth bytes.
+// Where the key parts from a leaf or from an inner node's prefix, a new node goes in to tell them
+// apart (no key is the start of another, so they always do part).
+void ARTIndex::add(Node*& node, const string& key, uint depth) {
+	if (node == nullptr) {
+		node = new_leaf(key);
+		return;
+	}
+	if (node->type == LEAF) {
+		const string& other = ((Leaf*)node)->key;
+		if (other == key)
+			throw DbRelationError("record is already in index " + this->name);
+		uint same = depth;
+		while (same < key.size() && same < other.size() && key[same] == other[same])
+			same++;
+		Node* parent = new_inner(NODE4, key.substr(depth, same - depth));
+		put_child((Inner*)parent, (unsigned char)other[same], node);
+		put_child((Inner*)parent, (unsigned char)key[same], new_leaf(key));
+		node = parent;
+		return;
+	}
+	Inner* inner = (Inner*)node;
+	uint same = 0;
+	while (same < inner->prefix.size() && depth + same < key.size() && inner->prefix[same] == key[depth + same])
+		same++;
+	if (same < inner->prefix.size()) {
+		Node* parent = new_inner(NODE4, inner->prefix.substr(0, same));
+		unsigned char byte = (unsigned char)inner->prefix[same];
+		set_prefix(inner, inner->prefix.substr(same + 1));
+		put_child((Inner*)parent, byte, inner);
+		put_child((Inner*)parent, (unsigned char)key[depth + same], new_leaf(key));
+		node = parent;
+		return;
+	}
+	depth += (uint)inner->prefix.size();
+	Node** next = child(inner, (unsigned char)key[depth]);
+	if (next != nullptr)
+		add(*next, key, depth + 1);
+	else
+		add_child(node, (unsigned char)key[depth], new_leaf(key));
+}
+
+// Take the key out from under node. Returns false if it isn't there.
+bool ARTIndex::remove(Node*& node, const string& key, uint depth) {
+	if (node == nullptr)
+		return false;
+	if (node->type == LEAF) {
+		if (((Leaf*)node)->key != key)
+			return false;
+		free(node);
+		node = nullptr;
+		return true;
+	}
+	Inner* inner = (Inner*)node;
+	if (key.compare(depth, inner->prefix.size(), inner->prefix) != 0)
+		return false;
+	depth += (uint)inner->prefix.size();
+	if (depth >= key.size())
+		return false;
+	unsigned char byte = (unsigned char)key[depth];
+	Node** next = child(inner, byte);
+	if (next == nullptr)
+		return false;
+	if ((*next)->type != LEAF)
+		return remove(*next, key, depth + 1);
+	if (((Leaf*)*next)->key != key)
+		return false;
+	free(*next);
+	remove_child(node, byte);
+	return true;
+}
+
+// Where the node keeps its child for the given byte (nullptr if it has none).
+ARTIndex::Node** ARTIndex::child(const Inner* node, unsigned char byte) const {
+	Inner* inner = const_cast<Inner*>(node);
+	switch (node->type) {
+		case NODE4: {
+			Node4* node4 = (Node4*)inner;
+			for (uint i = 0; i < node4->count; i++)
+				if (node4->bytes[i] == byte)
+					return &node4->children[i];
+			return nullptr;
+		}
+		case NODE16: {
+			Node16* node16 = (Node16*)inner;
+			unsigned char* at = lower_bound(node16->bytes, node16->bytes + node16->count, byte);
+			if (at == node16->bytes + node16->count || *at != byte)
+				return nullptr;
+			return &node16->children[at - node16->bytes];
+		}
+		case NODE48: {
+			Node48* node48 = (Node48*)inner;
+			return node48->slots[byte] == 0 ? nullptr : &node48->children[node48->slots[byte] - 1];
+		}
+		case NODE256: {
+			Node256* node256 = (Node256*)inner;
+			return node256->children[byte] == nullptr ? nullptr : &node256->children[byte];
+		}
+		default:
+			return nullptr;
+	}
+}
+
+// The child for the first byte, from the given one on, that the node has a child for (nullptr if
+// none), and that byte.
+ARTIndex::Node* ARTIndex::next_child(const Inner* node, uint from, unsigned char& byte) const {
+	switch (node->type) {
+		case NODE4:
+		case NODE16: {
+			const unsigned char* bytes = node->type == NODE4 ? ((const Node4*)node)->bytes : ((const Node16*)node)->bytes;
+			Node* const* children = node->type == NODE4 ? ((const Node4*)node)->children : ((const Node16*)node)->children;
+			for (uint i = 0; i < node->count; i++)
+				if (bytes[i] >= from) {
+					byte = bytes[i];
+					return children[i];
+				}
+			return nullptr;
+		}
+		case NODE48: {
+			const Node48* node48 = (const Node48*)node;
+			for (uint b = from; b < 256; b++)
+				if (node48->slots[b] != 0) {
+					byte = (unsigned char)b;
+					return node48->children[node48->slots[b] - 1];
+				}
+			return nullptr;
+		}
+		case NODE256: {
+			const Node256* node256 = (const Node256*)node;
+			for (uint b = from; b < 256; b++)
+				if (node256->children[b] != nullptr) {
+					byte = (unsigned char)b;
+					return node256->children[b];
+				}
+			return nullptr;
+		}
+		default:
+			return nullptr;
+	}
+}
+
+// Add a child, first moving to the next size of node if this one is full.
+void ARTIndex::add_child(Node*& node, unsigned char byte, Node* child) {
+	Inner* inner = (Inner*)node;
+	if (inner->type == NODE4 && inner->count == 4)
+		resize(node, NODE16);
+	else if (inner->type == NODE16 && inner->count == 16)
+		resize(node, NODE48);
+	else if (inner->type == NODE48 && inner->count == 48)
+		resize(node, NODE256);
+	put_child((Inner*)node, byte, child);
+}
+
+// Add a child to a node with room for it.
+void ARTIndex::put_child(Inner* node, unsigned char byte, Node* child) {
+	switch (node->type) {
+		case NODE4:
+		case NODE16: {
+			unsigned char* bytes = node->type == NODE4 ? ((Node4*)node)->bytes : ((Node16*)node)->bytes;
+			Node** children = node->type == NODE4 ? ((Node4*)node)->children : ((Node16*)node)->children;
+			uint at = (uint)(lower_bound(bytes, bytes + node->count, byte) - bytes);
+			memmove(bytes + at + 1, bytes + at, node->count - at);
+			memmove(children + at + 1, children + at, (node->count - at) * sizeof(Node*));
+			bytes[at] = byte;
+			children[at] = child;
+			break;
+		}
+		case NODE48: {
+			Node48* node48 = (Node48*)node;
+			uint slot = 0;
+			while (node48->children[slot] != nullptr)
+				slot++;
+			node48->children[slot] = child;
+			node48->slots[byte] = (unsigned char)(slot + 1);
+			break;
+		}
+		case NODE256:
+			((Node256*)node)->children[byte] = child;
+			break;
+		default:
+			break;
+	}
+	node->count++;
+}
+
+// Take out a child, then move to the size of node before this one if it is down to a few, or
+// fold a node down to one child into the child.
+void ARTIndex::remove_child(Node*& node, unsigned char byte) {
+	Inner* inner = (Inner*)node;
+	switch (inner->type) {
+		case NODE4:
+		case NODE16: {
+			unsigned char* bytes = inner->type == NODE4 ? ((Node4*)inner)->bytes : ((Node16*)inner)->bytes;
+			Node** children = inner->type == NODE4 ? ((Node4*)inner)->children : ((Node16*)inner)->children;
+			uint at = (uint)(lower_bound(bytes, bytes + inner->count, byte) - bytes);
+			memmove(bytes + at, bytes + at + 1, inner->count - at - 1);
+			memmove(children + at, children + at + 1, (inner->count - at - 1) * sizeof(Node*));
+			break;
+		}
+		case NODE48: {
+			Node48* node48 = (Node48*)inner;
+			node48->children[node48->slots[byte] - 1] = nullptr;
+			node48->slots[byte] = 0;
+			break;
+		}
+		case NODE256:
+			((Node256*)inner)->children[byte] = nullptr;
+			break;
+		default:
+			break;
+	}
+	inner->count--;
+
+	if (inner->type == NODE256 && inner->count <= 37) {
+		resize(node, NODE48);
+	} else if (inner->type == NODE48 && inner->count <= 12) {
+		resize(node, NODE16);
+	} else if (inner->type == NODE16 && inner->count <= 3) {
+		resize(node, NODE4);
+	} else if (inner->type == NODE4 && inner->count == 1) {
+		Node4* node4 = (Node4*)inner;
+		Node* only = node4->children[0];
+		if (only->type != LEAF)
+			set_prefix((Inner*)only, node4->prefix + (char)node4->bytes[0] + ((Inner*)only)->prefix);
+		free(node4);
+		node = only;
+	}
+}
+
+// Move a node's children to a new node of the given type (with the same prefix).
+void ARTIndex::resize(Node*& node, NodeType type) {
+	Inner* old = (Inner*)node;
+	Inner* resized = new_inner(type, old->prefix);
+	unsigned char byte;
+	for (uint from = 0; from < 256; from = byte + 1U) {
+		Node* next = next_child(old, from, byte);
+		if (next == nullptr)
+			break;
+		put_child(resized, byte, next);
+	}
+	free(old);
+	node = resized;
+}
+
+ARTIndex::Leaf* ARTIndex::new_leaf(const string& key) {
+	Leaf* leaf = new Leaf();
+	leaf->type = LEAF;
+	leaf->key = key;
+	this->memory += node_size(LEAF) + key.size();
+	return leaf;
+}
+
+ARTIndex::Inner* ARTIndex::new_inner(NodeType type, const string& prefix) {
+	Inner* inner;
+	switch (type) {
+		case NODE4:
+			inner = new Node4();
+			break;
+		case NODE16:
+			inner = new Node16();
+			break;
+		case NODE48:
+			inner = new Node48();
+			break;
+		default:
+			inner = new Node256();
+			break;
+	}
+	inner->type = type;
+	inner->count = 0;
+	inner->prefix = prefix;
+	this->memory += node_size(type) + prefix.size();
+	return inner;
+}
+
+void ARTIndex::set_prefix(Inner* node, const string& prefix) {
+	this->memory += prefix.size();
+	this->memory -= node->prefix.size();
+	node->prefix = prefix;
+}
+
+// Delete just the node (not its children).
+void ARTIndex::free(Node* node) {
+	this->memory -= node_size(node->type);
+	switch (node->type) {
+		case LEAF:
+			this->memory -= ((Leaf*)node)->key.size();
+			delete (Leaf*)node;
+			return;
+		case NODE4:
+			this->memory -= ((Inner*)node)->prefix.size();
+			delete (Node4*)node;
+			return;
+		case NODE16:
+			this->memory -= ((Inner*)node)->prefix.size();
+			delete (Node16*)node;
+			return;
+		case NODE48:
+			this->memory -= ((Inner*)node)->prefix.size();
+			delete (Node48*)node;
+			return;
+		case NODE256:
+			this->memory -= ((Inner*)node)->prefix.size();
+			delete (Node256*)node;
+			return;
+	}
+}
+
+// Delete the node and everything under it.
+void ARTIndex::free_all(Node* node) {
+	if (node == nullptr)
+		return;
+	if (node->type != LEAF) {
+		unsigned char byte;
+		for (uint from = 0; from < 256; from = byte + 1U) {
+			Node* next = next_child((Inner*)node, from, byte);
+			if (next == nullptr)
+				break;
+			free_all(next);
+		}
+	}
+	free(node);
+}
+
+size_t ARTIndex::node_size(NodeType type) {
+	switch (type) {
+		case LEAF:
+			return sizeof(Leaf);
+		case NODE4:
+			return sizeof(Node4);
+		case NODE16:
+			return sizeof(Node16);
+		case NODE48:
+			return sizeof(Node48);
+		default:
+			return sizeof(Node256);
+	}
+}
+
+
+/*
+ * *******************
+ * Testing
+ * *******************
+ */
+
+// test function -- returns true if all tests pass
+bool test_art_index() {
+	ColumnNames column_names;
+	column_names.push_back("a");
+	column_names.push_back("b");
+	ColumnAttributes column_attributes;
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	HeapTable table("_test_art_cpp", column_names, column_attributes);
+	table.create();
+
+	const int N = 3000;
+	map<int, Handle> by_a;
+	ValueDict row;
+	for (int i = 0; i < N; i++) {
+		row["a"] = Value(N - i);
+		row["b"] = Value("name" + to_string(i % 100));
+		by_a[N - i] = table.insert(&row);
+	}
+
+	ColumnNames just_a(1, "a"), b_then_a;
+	b_then_a.push_back("b");
+	b_then_a.push_back("a");
+	ARTIndex index(table, "fxa", just_a, true);
+	index.create();
+	ARTIndex by_b(table, "fxb", b_then_a, false);
+	by_b.create();
+	ARTIndex not_unique(table, "fxbu", ColumnNames(1, "b"), true);
+	bool refused = false;
+	try {
+		not_unique.create();
+	} catch (DbRelationError& e) {
+		refused = true;
+	}
+	if (!refused || index.get_size() != (size_t)N || index.get_memory() == 0)
+		return false;
+	cout << "art create ok (" << index.get_size() << " keys in " << index.get_memory() << " bytes)" << endl;
+
+	ValueDict key;
+	for (int a = 1; a <= N; a += 37) {
+		key["a"] = Value(a);
+		Handles* handles = index.lookup(&key);
+		bool found = handles->size() == 1 && (*handles)[0] == by_a[a];
+		delete handles;
+		if (!found)
+			return false;
+	}
+	key["a"] = Value(N + 1);
+	Handles* handles = index.lookup(&key);
+	bool missing = handles->empty();
+	delete handles;
+	ValueDict min_key, max_key;
+	min_key["a"] = Value(100);
+	max_key["a"] = Value(199);
+	handles = index.range(&min_key, &max_key);
+	bool in_order = missing && handles->size() == 100;
+	for (uint i = 0; in_order && i < handles->size(); i++)
+		in_order = (*handles)[i] == by_a[100 + (int)i];
+	delete handles;
+	key.clear();
+	key["b"] = Value("name7");
+	handles = by_b.lookup(&key);
+	in_order = in_order && handles->size() == N / 100;
+	for (uint i = 0; in_order && i < handles->size(); i++)
+		in_order = (*handles)[i] == by_a[N - 7 - 100 * ((int)handles->size() - 1 - (int)i)];
+	delete handles;
+	if (!in_order)
+		return false;
+	cout << "art lookup/range ok" << endl;
+
+	// the table keeps them up to date, and a closed index is built again when it's next used
+	table.add_index(&index);
+	table.add_index(&by_b);
+	size_t memory = index.get_memory();
+	for (int a = 1; a <= 1000; a++) {
+		table.del(by_a[a]);
+		by_a.erase(a);
+	}
+	bool kept = index.get_size() == (size_t)N - 1000 && index.get_memory() < memory;
+	row["a"] = Value(5);
+	row["b"] = Value("again");
+	by_a[5] = table.insert(&row);
+	index.close();
+	by_b.close();
+	row["a"] = Value(6);
+	by_a[6] = table.insert(&row);
+	key.clear();
+	key["b"] = Value("again");
+	handles = by_b.lookup(&key);
+	kept = kept && handles->size() == 2 && (*handles)[0] == by_a[5] && (*handles)[1] == by_a[6];
+	delete handles;
+	handles = index.range(nullptr, nullptr);
+	kept = kept && handles->size() == by_a.size();
+	uint i = 0;
+	for (auto const& entry: by_a)
+		kept = kept && (*handles)[i++] == entry.second;
+	delete handles;
+	table.remove_index(&index);
+	table.remove_index(&by_b);
+	if (!kept)
+		return false;
+	cout << "art maintenance ok (" << index.get_size() << " keys in " << index.get_memory() << " bytes)" << endl;
+
+	index.drop();
+	by_b.drop();
+	table.drop();
+	return true;
+}
+
+// Nanoseconds per call of lookup and of range (over ten keys), ART and B+tree.
+static double bench_ns(DbIndex& index, uint keys, bool ranges) {
+	const uint OPS = 200000;
+	ValueDict key, max_key;
+	auto start = chrono::steady_clock::now();
+	for (uint i = 0; i < OPS; i++) {
+		int k = (int)(((uint64_t)i * 2654435761U) % keys);
+		key["a"] = Value(k);
+		if (ranges) {
+			max_key["a"] = Value(k + 9);
+			delete index.range(&key, &max_key);
+		} else {
+			delete index.lookup(&key);
+		}
+	}
+	return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / OPS;
+}
+
+void bench_art_index() {
+	const uint ROWS = 100000;
+	ColumnNames column_names(1, "a");
+	ColumnAttributes column_attributes(1, ColumnAttribute(ColumnAttribute::INT));
+	HeapTable table("_bench_art_cpp", column_names, column_attributes);
+	table.create();
+	ValueDict row;
+	for (uint i = 0; i < ROWS; i++) {
+		row["a"] = Value((int)i);
+		table.insert(&row);
+	}
+	ARTIndex art(table, "bxart", column_names, false);
+	art.create();
+	BTreeIndex btree(table, "bxbtree", column_names, false);
+	btree.create();
+	cout << "art of " << ROWS << " keys (" << art.get_memory() << " bytes), nanoseconds per call:" << endl
+		 << "  lookup: art " << (u_long)bench_ns(art, ROWS, false) << ", btree " << (u_long)bench_ns(btree, ROWS, false) << endl
+		 << "  range of 10: art " << (u_long)bench_ns(art, ROWS, true) << ", btree " << (u_long)bench_ns(btree, ROWS, true) << endl;
+	art.drop();
+	btree.drop();
+	table.drop();
+}
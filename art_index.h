@@ -0,0 +1,124 @@
+/**
+ * @file art_index.h - Implementation of storage_engine's DbIndex with an adaptive radix tree.
+ * ARTIndex: DbIndex
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#pragma once
+
+#include "storage_engine.h"
+
+/**
+ * @class ARTIndex - DbIndex implementation with an adaptive radix tree, kept only in memory
+ *
+ * Each record's key is its KeyCodec key with its handle on the end, so the keys are distinct and
+ * none is the start of another, and the tree goes down them a byte at a time. An inner node has a
+ * child for each next byte that some key under it has, and comes in four sizes, each replaced by
+ * the next as children are added (and by the one before as they are taken out): up to 4 children
+ * or up to 16, with their bytes kept sorted; up to 48, found through a 256-byte index; and one
+ * slot for every byte. A node left with one child is folded into it, and the bytes all of a
+ * node's keys share are kept once as its prefix, so a lookup only visits a node where keys
+ * actually differ. Leaves have the whole key.
+ *
+ * Nothing is kept on disk: create and open build the tree from the relation's records (as does
+ * the first insert or del after the index is closed), and insert and del keep it up to date.
+ * Lookups and ranges work like BTreeIndex's: the values can be just the leading columns of the
+ * key, and the records come back in key order. For unique indices, insert refuses a record whose
+ * key is already there (unless the key has a NULL in it).
+ */
+class ARTIndex : public DbIndex {
+public:
+	ARTIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique);
+	virtual ~ARTIndex();
+	ARTIndex(const ARTIndex& other) = delete;
+	ARTIndex(ARTIndex&& temp) = delete;
+	ARTIndex& operator=(const ARTIndex& other) = delete;
+	ARTIndex& operator=(ARTIndex&& temp) = delete;
+
+	virtual void create();
+	virtual void drop();
+	virtual void open();
+	virtual void close();
+	virtual Handles* lookup(ValueDict* key_values) const;
+	virtual Handles* range(ValueDict* min_key, ValueDict* max_key) const;
+	virtual void insert(Handle record);
+	virtual void insert_many(const Handles* records);
+	virtual void del(Handle record);
+
+	// statistics
+	virtual size_t get_size() const {return size;}
+
+	/**
+	 * @returns  bytes taken up by the nodes and the keys and prefixes in them
+	 */
+	virtual size_t get_memory() const {return memory;}
+
+protected:
+	enum NodeType {LEAF, NODE4, NODE16, NODE48, NODE256};
+	struct Node {
+		NodeType type;
+	};
+	struct Leaf : Node {
+		std::string key;
+	};
+	struct Inner : Node {
+		uint count;
+		std::string prefix;
+	};
+	struct Node4 : Inner {
+		unsigned char bytes[4];
+		Node* children[4];
+	};
+	struct Node16 : Inner {
+		unsigned char bytes[16];
+		Node* children[16];
+	};
+	struct Node48 : Inner {
+		unsigned char slots[256];  // 0 for no child, otherwise the child's slot plus one
+		Node* children[48];
+	};
+	struct Node256 : Inner {
+		Node* children[256];
+	};
+	typedef std::function<bool(const std::string& key)> KeyVisitor;  // returns false to stop
+
+	bool closed;
+	Node* root;
+	size_t size;
+	size_t memory;
+	KeyCodec codec;
+	ColumnOrdinals key_ordinals;
+
+	virtual std::string entry_key(const Row& key_values, Handle record, bool* any_null=nullptr) const;
+	virtual std::string search_key(const ValueDict* key_values) const;
+	virtual Handles* scan(const std::string& from, const std::string* through) const;
+	virtual bool walk(const Node* node, uint depth, const std::string& from, const std::string* through,
+			bool bounded, KeyVisitor& visit) const;
+	virtual void add(const std::string& key, bool any_null);
+	virtual void add(Node*& node, const std::string& key, uint depth);
+	virtual bool remove(Node*& node, const std::string& key, uint depth);
+	virtual Node** child(const Inner* node, unsigned char byte) const;
+	virtual Node* next_child(const Inner* node, uint from, unsigned char& byte) const;
+	virtual void add_child(Node*& node, unsigned char byte, Node* child);
+	virtual void put_child(Inner* node, unsigned char byte, Node* child);
+	virtual void remove_child(Node*& node, unsigned char byte);
+	virtual void resize(Node*& node, NodeType type);
+	virtual Leaf* new_leaf(const std::string& key);
+	virtual Inner* new_inner(NodeType type, const std::string& prefix);
+	virtual void set_prefix(Inner* node, const std::string& prefix);
+	virtual void free(Node* node);
+	virtual void free_all(Node* node);
+
+	static size_t node_size(NodeType type);
+};
+
+/**
+ * Test ARTIndex.
+ * @returns  true if all the tests pass
+ */
+bool test_art_index();
+
+/**
+ * Nanoseconds per lookup and per short range in an ARTIndex, next to a BTreeIndex on the same keys.
+ */
+void bench_art_index();
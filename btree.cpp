@@ -0,0 +1,1598 @@
+/**
+ * @file btree.cpp - implementation of:
+ * BTreeNode
+ * BTreeIndex
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#include <memory.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include "btree.h"
+#include "buffer_pool.h"
+#include "heap_storage.h"
+using namespace std;
+
+typedef uint16_t u16;
+
+
+/*
+ * *******************
+ * BTreeNode class
+ * *******************
+ */
+
+BTreeNode::BTreeNode(Db* db, BlockID block_id, bool is_new, bool is_leaf) : db(db), block_id(block_id), bytes(nullptr) {
+	this->bytes = _BUFFER_POOL->pin(db, block_id, !is_new);
+	if (is_new) {
+		this->bytes[0] = is_leaf ? 1 : 0;
+		clear();
+		set_link(0);
+		mark_dirty();
+	}
+}
+
+BTreeNode::BTreeNode(char* bytes, BlockID block_id, bool is_leaf) : db(nullptr), block_id(block_id), bytes(bytes) {
+	this->bytes[0] = is_leaf ? 1 : 0;
+	clear();
+	set_link(0);
+}
+
+BTreeNode::BTreeNode(char* bytes, BlockID block_id) : db(nullptr), block_id(block_id), bytes(bytes) {
+}
+
+BTreeNode::~BTreeNode() {
+	if (this->db != nullptr)
+		_BUFFER_POOL->unpin(this->db, this->block_id);
+}
+
+TextView BTreeNode::suffix(uint i) const {
+	uint at = cell(i);
+	return TextView(this->bytes + at + 4, get_n(at));
+}
+
+string BTreeNode::key(uint i) const {
+	string key;
+	get_key(i, key);
+	return key;
+}
+
+void BTreeNode::get_key(uint i, string& key) const {
+	TextView prefix = this->prefix(), suffix = this->suffix(i);
+	key.assign(prefix.get_data(), prefix.get_size());
+	key.append(suffix.get_data(), suffix.get_size());
+}
+
+TextView BTreeNode::value(uint i) const {
+	uint at = cell(i);
+	return TextView(this->bytes + at + 4 + get_n(at), get_n(at + 2));
+}
+
+BlockID BTreeNode::child(uint i) const {
+	BlockID block_id;
+	memcpy(&block_id, value(i).get_data(), sizeof(block_id));
+	return block_id;
+}
+
+BlockID BTreeNode::get_link() const {
+	BlockID block_id;
+	memcpy(&block_id, this->bytes + 8, sizeof(block_id));
+	return block_id;
+}
+
+void BTreeNode::set_link(BlockID block_id) {
+	memcpy(this->bytes + 8, &block_id, sizeof(block_id));
+}
+
+// A key that doesn't start with the prefix goes before or after every entry; otherwise the rest of it
+// is compared with the suffixes.
+uint BTreeNode::lower_bound(const TextView& key) const {
+	TextView prefix = this->prefix();
+	uint p = prefix.get_size();
+	int c = TextView(key.get_data(), min(key.get_size(), p)).compare(prefix);
+	if (c != 0 || key.get_size() < p)
+		return c > 0 ? size() : 0;
+	TextView rest(key.get_data() + p, key.get_size() - p);
+	uint lo = 0, hi = size();
+	while (lo < hi) {
+		uint mid = (lo + hi) / 2;
+		if (suffix(mid).compare(rest) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// The child of the last entry whose key is not greater than the given one.
+BlockID BTreeNode::find(const TextView& key) const {
+	TextView prefix = this->prefix();
+	uint p = prefix.get_size();
+	int c = TextView(key.get_data(), min(key.get_size(), p)).compare(prefix);
+	uint lo = 0, hi = size();
+	if (c != 0 || key.get_size() < p) {
+		lo = c > 0 ? size() : 0;
+	} else {
+		TextView rest(key.get_data() + p, key.get_size() - p);
+		while (lo < hi) {
+			uint mid = (lo + hi) / 2;
+			if (suffix(mid).compare(rest) <= 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+	}
+	return lo == 0 ? get_link() : child(lo - 1);
+}
+
+bool BTreeNode::has_room(const TextView& key, uint value_size) const {
+	uint p = get_n(12), n = size();
+	uint used = DbBlock::BLOCK_SZ - get_n(4) - get_n(6);  // the cells still in use
+	uint q = min(p, common_prefix(prefix(), key));
+	return HEADER_SZ + q + 2 * (n + 1) + used + (p - q) * n + 4 + key.get_size() - q + value_size
+			<= DbBlock::BLOCK_SZ;
+}
+
+bool BTreeNode::has_room_for(uint key_size, uint value_size) const {
+	uint used = DbBlock::BLOCK_SZ - get_n(4) - get_n(6);
+	return HEADER_SZ + 2 * (size() + 1) + used + get_n(12) * size() + 4 + key_size + value_size
+			<= DbBlock::BLOCK_SZ;
+}
+
+// A key that doesn't start with the whole prefix makes it shorter, so every entry is written again.
+void BTreeNode::insert(uint i, const TextView& key, const TextView& value) {
+	uint p = get_n(12);
+	if (common_prefix(prefix(), key) < p) {
+		if (!has_room(key, value.get_size()))
+			throw DbBlockNoRoomError("not enough room for new index entry");
+		Entries entries;
+		for (uint j = 0; j <= size(); j++) {
+			if (j == i)
+				entries.push_back(make_pair(key.str(), value.str()));
+			if (j < size())
+				entries.push_back(make_pair(this->key(j), this->value(j).str()));
+		}
+		rebuild(entries, common_prefix(prefix(), key));
+		return;
+	}
+	uint cell_size = 4 + key.get_size() - p + value.get_size();
+	if (free_space() < cell_size + 2) {
+		if (!has_room(key, value.get_size()))
+			throw DbBlockNoRoomError("not enough room for new index entry");
+		compact();
+	}
+	uint at = get_n(4) - cell_size;
+	put_n(at, key.get_size() - p);
+	put_n(at + 2, value.get_size());
+	memcpy(this->bytes + at + 4, key.get_data() + p, key.get_size() - p);
+	memcpy(this->bytes + at + 4 + key.get_size() - p, value.get_data(), value.get_size());
+	put_n(4, at);
+	uint n = size();
+	memmove(this->bytes + slots() + 2 * (i + 1), this->bytes + slots() + 2 * i, 2 * (n - i));
+	put_n(slots() + 2 * i, at);
+	put_n(2, n + 1);
+}
+
+// Sorted keys all share what the first and last ones do.
+void BTreeNode::load(const Entries& entries) {
+	rebuild(entries, entries.empty() ? 0 : common_prefix(entries.front().first, entries.back().first));
+}
+
+void BTreeNode::remove(uint i) {
+	uint at = cell(i);
+	put_n(6, get_n(6) + 4 + get_n(at) + get_n(at + 2));
+	uint n = size();
+	memmove(this->bytes + slots() + 2 * i, this->bytes + slots() + 2 * (i + 1), 2 * (n - i - 1));
+	put_n(2, n - 1);
+}
+
+void BTreeNode::clear() {
+	put_n(2, 0);
+	put_n(4, DbBlock::BLOCK_SZ);
+	put_n(6, 0);
+	put_n(12, 0);
+}
+
+uint BTreeNode::packed_size(uint entries, uint entry_bytes, uint prefix_size) {
+	return HEADER_SZ + prefix_size + entries * (2 + 4) + entry_bytes - entries * prefix_size;
+}
+
+uint BTreeNode::common_prefix(const TextView& a, const TextView& b) {
+	uint n = min(a.get_size(), b.get_size()), i = 0;
+	while (i < n && a.get_data()[i] == b.get_data()[i])
+		i++;
+	return i;
+}
+
+void BTreeNode::mark_dirty() {
+	if (this->db != nullptr)
+		_BUFFER_POOL->mark_dirty(this->db, this->block_id);
+}
+
+uint BTreeNode::get_n(uint offset) const {
+	return *(u16*)(this->bytes + offset);
+}
+
+void BTreeNode::put_n(uint offset, uint n) {
+	*(u16*)(this->bytes + offset) = (u16)n;
+}
+
+uint BTreeNode::free_space() const {
+	return get_n(4) - (slots() + 2 * size());
+}
+
+// Pack the cells back together at the end of the block, squeezing out what remove left behind.
+void BTreeNode::compact() {
+	char* copy = new char[DbBlock::BLOCK_SZ];
+	memcpy(copy, this->bytes, DbBlock::BLOCK_SZ);
+	uint end = DbBlock::BLOCK_SZ;
+	for (uint i = 0; i < size(); i++) {
+		uint at = cell(i);
+		uint cell_size = 4 + *(u16*)(copy + at) + *(u16*)(copy + at + 2);
+		end -= cell_size;
+		memcpy(this->bytes + end, copy + at, cell_size);
+		put_n(slots() + 2 * i, end);
+	}
+	put_n(4, end);
+	put_n(6, 0);
+	delete[] copy;
+}
+
+// Write the entries (whole keys, in order) into the emptied node with the given prefix, which they
+// all have to start with.
+void BTreeNode::rebuild(const Entries& entries, uint prefix_size) {
+	uint entry_bytes = 0;
+	for (auto const& entry: entries)
+		entry_bytes += (uint)(entry.first.size() + entry.second.size());
+	if (packed_size((uint)entries.size(), entry_bytes, prefix_size) > DbBlock::BLOCK_SZ)
+		throw DbBlockNoRoomError("not enough room for index entries");
+	clear();
+	put_n(12, prefix_size);
+	if (prefix_size > 0)
+		memcpy(this->bytes + HEADER_SZ, entries.front().first.data(), prefix_size);
+	for (uint i = 0; i < entries.size(); i++)
+		insert(i, entries[i].first, entries[i].second);
+}
+
+
+/*
+ * *******************
+ * KeySorter class
+ * *******************
+ */
+
+KeySorter::KeySorter(size_t memory) : memory(memory), used(0), keys(), position(0), runs(), heads(), sorted(false) {
+}
+
+KeySorter::~KeySorter() {
+	for (auto run: this->runs)
+		fclose(run);
+}
+
+void KeySorter::add(const string& key) {
+	this->keys.push_back(key);
+	this->used += key.size() + sizeof(string);
+	if (this->used >= this->memory)
+		spill();
+}
+
+bool KeySorter::next(string& key) {
+	if (!this->sorted) {
+		this->sorted = true;
+		if (this->runs.empty()) {
+			sort(this->keys.begin(), this->keys.end());
+		} else {
+			spill();
+			for (uint run = 0; run < this->runs.size(); run++) {
+				rewind(this->runs[run]);
+				string first;
+				if (read(run, first))
+					this->heads.push(Head(first, run));
+			}
+		}
+	}
+	if (this->runs.empty()) {
+		if (this->position == this->keys.size())
+			return false;
+		key.swap(this->keys[this->position++]);
+		return true;
+	}
+	if (this->heads.empty())
+		return false;
+	Head head = this->heads.top();
+	this->heads.pop();
+	key.swap(head.first);
+	string following;
+	if (read(head.second, following))
+		this->heads.push(Head(following, head.second));
+	return true;
+}
+
+// Sort the keys we have and write them out as a run (each key's size, then the key).
+void KeySorter::spill() {
+	if (this->keys.empty())
+		return;
+	sort(this->keys.begin(), this->keys.end());
+	FILE* run = tmpfile();
+	if (run == nullptr)
+		throw DbRelationError("can't make a temporary file for sorting");
+	this->runs.push_back(run);
+	for (auto const& key: this->keys) {
+		uint32_t size = (uint32_t)key.size();
+		if (fwrite(&size, sizeof(size), 1, run) != 1 || fwrite(key.data(), 1, size, run) != size)
+			throw DbRelationError("can't write sort run");
+	}
+	this->keys.clear();
+	this->used = 0;
+}
+
+bool KeySorter::read(uint run, string& key) {
+	uint32_t size;
+	if (fread(&size, sizeof(size), 1, this->runs[run]) != 1)
+		return false;
+	key.resize(size);
+	if (size > 0 && fread(&key[0], 1, size, this->runs[run]) != size)
+		throw DbRelationError("can't read sort run");
+	return true;
+}
+
+
+/*
+ * *******************
+ * NodeVersions class
+ * *******************
+ */
+
+NodeVersions::NodeVersions() {
+	for (auto& chunk: this->chunks)
+		chunk = nullptr;
+}
+
+NodeVersions::~NodeVersions() {
+	for (auto& chunk: this->chunks)
+		delete[] chunk.load();
+}
+
+uint64_t NodeVersions::read_lock(BlockID block_id) {
+	atomic<uint64_t>& counter = at(block_id);
+	uint64_t version;
+	while ((version = counter.load(memory_order_acquire)) & 1)
+		this_thread::yield();
+	return version;
+}
+
+// The fence keeps the reads of the block from being put off until after the version is checked.
+bool NodeVersions::validate(BlockID block_id, uint64_t version) {
+	atomic_thread_fence(memory_order_acquire);
+	return at(block_id).load(memory_order_relaxed) == version;
+}
+
+bool NodeVersions::upgrade(BlockID block_id, uint64_t version) {
+	return (version & 1) == 0 && at(block_id).compare_exchange_strong(version, version + 1);
+}
+
+void NodeVersions::unlock(BlockID block_id) {
+	at(block_id).fetch_add(1, memory_order_release);
+}
+
+// If two threads make the same chunk at once, the one that loses throws its copy away.
+atomic<uint64_t>& NodeVersions::at(BlockID block_id) {
+	uint n = block_id / CHUNK_SZ;
+	if (n >= MAX_CHUNKS)
+		throw DbRelationError("block " + to_string(block_id) + " is past the last one with a version");
+	atomic<uint64_t>* chunk = this->chunks[n].load();
+	if (chunk == nullptr) {
+		atomic<uint64_t>* made = new atomic<uint64_t>[CHUNK_SZ];
+		for (uint i = 0; i < CHUNK_SZ; i++)
+			made[i] = 0;
+		if (this->chunks[n].compare_exchange_strong(chunk, made))
+			chunk = made;
+		else
+			delete[] made;
+	}
+	return chunk[block_id % CHUNK_SZ];
+}
+
+
+/*
+ * *******************
+ * BTreeIndex class
+ * *******************
+ */
+
+const uint32_t BTreeIndex::STAT_BLOCK;  // make_pair takes it by reference
+double BTreeIndex::fill_factor = 0.9;
+size_t BTreeIndex::sort_memory = 32 * 1024 * 1024;
+
+BTreeIndex::BTreeIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique,
+		ColumnNames include_columns) :
+		DbIndex(relation, name, key_columns, unique, include_columns), dbfilename(""), closed(true),
+		db(_DB_ENV, 0), root(0), height(0), last(0), versions(), open_latch(), allocate_latch(),
+		unique_latch(), codec(), include_codec(), key_ordinals(), entry_ordinals() {
+	if (this->key_columns.empty() || this->key_columns.size() + this->include_columns.size() > MAX_COMPOSITE)
+		throw DbRelationError("index " + name + " must have 1 to " + to_string(MAX_COMPOSITE) + " columns");
+	this->dbfilename = relation.get_table_name() + "-" + name + ".btree";
+	this->key_ordinals = relation.column_ordinals(&this->key_columns);
+	ColumnOrdinals include_ordinals;
+	if (!this->include_columns.empty())
+		include_ordinals = relation.column_ordinals(&this->include_columns);
+	this->entry_ordinals = this->key_ordinals;
+	this->entry_ordinals.insert(this->entry_ordinals.end(), include_ordinals.begin(), include_ordinals.end());
+	ColumnAttributes column_attributes = relation.get_column_attributes();
+	ColumnAttributes key_attributes, include_attributes;
+	for (auto ordinal: this->key_ordinals)
+		key_attributes.push_back(column_attributes[ordinal]);
+	for (auto ordinal: include_ordinals)
+		include_attributes.push_back(column_attributes[ordinal]);
+	this->codec = KeyCodec(key_attributes);
+	this->include_codec = KeyCodec(include_attributes);
+}
+
+// Write back anything the buffer pool still has of ours before our Db handle goes away.
+BTreeIndex::~BTreeIndex() {
+	close();
+}
+
+// Build the tree for the relation's records in one pass over them (see bulk_load). If that fails
+// (e.g., a unique index on values that aren't), the file is removed again.
+void BTreeIndex::create() {
+	db_open(DB_CREATE|DB_EXCL);
+	this->closed = false;
+	this->last = 0;
+	allocate();  // STAT_BLOCK
+	try {
+		KeySorter entries(sort_memory);
+		this->relation.scan(nullptr, this->entry_ordinals, [this, &entries](Handle handle, const Row& row) {
+			string key = entry_key(row, handle);
+			entries.add(sort_entry(key, entry_value(row, (uint)key.size())));
+		});
+		bulk_load(entries);
+	} catch (...) {
+		drop();
+		throw;
+	}
+	write_stat();
+}
+
+// Remove the file.
+void BTreeIndex::drop() {
+	if (!this->closed) {
+		_BUFFER_POOL->discard(&this->db);
+		this->db.close(0);
+		this->closed = true;
+	}
+	Db db(_DB_ENV, 0);
+	db.remove(this->dbfilename.c_str(), nullptr, 0);
+}
+
+// Lookups open the index the first time they need it, maybe from several threads at once, so the
+// index is only marked open once the root and height have been read.
+void BTreeIndex::open() {
+	if (!this->closed)
+		return;
+	lock_guard<mutex> lock(this->open_latch);
+	if (!this->closed)
+		return;
+	db_open();
+	char* stat = _BUFFER_POOL->pin(&this->db, STAT_BLOCK);
+	BlockID root;
+	uint height;
+	uint32_t format;
+	memcpy(&root, stat, sizeof(root));
+	memcpy(&height, stat + sizeof(root), sizeof(height));
+	memcpy(&format, stat + sizeof(root) + sizeof(height), sizeof(format));
+	_BUFFER_POOL->unpin(&this->db, STAT_BLOCK);
+	if (format != FORMAT) {
+		_BUFFER_POOL->discard(&this->db);
+		this->db.close(0);
+		throw DbRelationError("index " + this->name + " was built with an older node layout; drop and create it again");
+	}
+	this->root = root;
+	this->height = height;
+	this->closed = false;
+}
+
+void BTreeIndex::close() {
+	if (this->closed)
+		return;
+	_BUFFER_POOL->flush(&this->db);
+	_BUFFER_POOL->discard(&this->db);
+	this->db.close(0);
+	this->closed = true;
+}
+
+Handles* BTreeIndex::lookup(ValueDict* key_values) const {
+	string key = search_key(key_values);
+	return scan(key, &key);
+}
+
+// Either end can be left off (nullptr) to go from the first key or through the last one.
+Handles* BTreeIndex::range(ValueDict* min_key, ValueDict* max_key) const {
+	string from = min_key == nullptr ? "" : search_key(min_key);
+	if (max_key == nullptr)
+		return scan(from, nullptr);
+	string through = search_key(max_key);
+	return scan(from, &through);
+}
+
+void BTreeIndex::insert(Handle record) {
+	Row* row = this->relation.project_row(record, this->entry_ordinals);
+	bool any_null;
+	string key, value;
+	try {
+		key = entry_key(*row, record, &any_null);
+		value = entry_value(*row, (uint)key.size());
+	} catch (...) {
+		delete row;
+		throw;
+	}
+	delete row;
+	add(key, value, any_null);
+}
+
+void BTreeIndex::del(Handle record) {
+	Row* row = this->relation.project_row(record, this->key_ordinals);
+	string key;
+	try {
+		key = entry_key(*row, record);
+	} catch (...) {
+		delete row;
+		throw;
+	}
+	delete row;
+	open();
+	remove_entry(key);
+}
+
+// The batch's entries go in in key order, so one after another mostly land in the same leaf (still
+// in the buffer pool) and the leaves are changed front to back. For unique indices, every key is
+// checked before any of them goes in.
+void BTreeIndex::insert_many(const Handles* records) {
+	open();
+	Rows* rows = this->relation.project_many(records, this->entry_ordinals);
+	vector<pair<string, string>> keys;  // each entry's key and value
+	keys.reserve(records->size());
+	try {
+		for (uint i = 0; i < records->size(); i++) {
+			string key = entry_key(*(*rows)[i], (*records)[i]);
+			string value = entry_value(*(*rows)[i], (uint)key.size());
+			keys.push_back(make_pair(key, value));
+		}
+	} catch (...) {
+		for (auto row: *rows)
+			delete row;
+		delete rows;
+		throw;
+	}
+	for (auto row: *rows)
+		delete row;
+	delete rows;
+	sort(keys.begin(), keys.end());
+
+	unique_lock<mutex> lock(this->unique_latch, defer_lock);
+	if (this->unique) {
+		lock.lock();
+		for (uint i = 0; i < keys.size(); i++) {
+			string values = keys[i].first.substr(0, keys[i].first.size() - KeyCodec::HANDLE_SZ);
+			if (this->codec.has_null(values.data(), (uint)values.size()))
+				continue;
+			const string& previous = i > 0 ? keys[i - 1].first : values;
+			bool duplicate = i > 0 && previous.compare(0, previous.size() - KeyCodec::HANDLE_SZ, values) == 0;
+			if (!duplicate) {
+				Handles* same = scan(values, &values);
+				duplicate = !same->empty();
+				delete same;
+			}
+			if (duplicate)
+				throw DbRelationError("duplicate key for unique index " + this->name);
+		}
+	}
+	uint done = 0;
+	try {
+		for (auto const& key: keys) {
+			insert_entry(key.first, key.second);
+			done++;
+		}
+	} catch (...) {
+		for (uint i = 0; i < done; i++)
+			remove_entry(keys[i].first);
+		throw;
+	}
+}
+
+// Wrapper for Berkeley DB open, which does both open and creation.
+void BTreeIndex::db_open(uint flags) {
+	if (!this->closed)
+		return;
+	this->db.set_re_len(DbBlock::BLOCK_SZ);
+	this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags|DB_THREAD, 0644);
+
+	DB_BTREE_STAT* stat;
+	this->db.stat(nullptr, &stat, DB_FAST_STAT);
+	this->last = stat->bt_ndata;
+	free(stat);
+}
+
+void BTreeIndex::write_stat() {
+	BlockID root = this->root;
+	uint height = this->height;
+	uint32_t format = FORMAT;
+	char* stat = _BUFFER_POOL->pin(&this->db, STAT_BLOCK);
+	memcpy(stat, &root, sizeof(root));
+	memcpy(stat + sizeof(root), &height, sizeof(height));
+	memcpy(stat + sizeof(root) + sizeof(height), &format, sizeof(format));
+	_BUFFER_POOL->mark_dirty(&this->db, STAT_BLOCK);
+	_BUFFER_POOL->unpin(&this->db, STAT_BLOCK);
+}
+
+// The node in the given block (pinned until it is deleted).
+BTreeNode* BTreeIndex::get(BlockID block_id) const {
+	return new BTreeNode(&this->db, block_id);
+}
+
+// A new, empty node at the end of the file.
+BTreeNode* BTreeIndex::get_new(bool is_leaf) {
+	return new BTreeNode(&this->db, allocate(), true, is_leaf);
+}
+
+// Add a block to the end of the file. It is written out right away so the file knows how many
+// blocks it has.
+BlockID BTreeIndex::allocate() {
+	lock_guard<mutex> lock(this->allocate_latch);
+	BlockID block_id = ++this->last;
+	char* zeros = new char[DbBlock::BLOCK_SZ]();
+	Dbt key(&block_id, sizeof(block_id));
+	Dbt data(zeros, DbBlock::BLOCK_SZ);
+	this->db.put(nullptr, &key, &data, 0);
+	delete[] zeros;
+	return block_id;
+}
+
+// A record's leaf key: its key values and its handle.
+string BTreeIndex::entry_key(const Row& key_values, Handle record, bool* any_null) const {
+	string key;
+	bool has_null = this->codec.encode(key_values, key);
+	KeyCodec::append_handle(key, record);
+	if (key.size() > MAX_KEY_SZ)
+		throw DbRelationError("key too big for index " + this->name);
+	if (any_null != nullptr)
+		*any_null = has_null;
+	return key;
+}
+
+// A record's leaf value: the values of its included columns (which follow the key's in the row).
+string BTreeIndex::entry_value(const Row& values, uint key_size) const {
+	string value;
+	if (!this->include_columns.empty())
+		this->include_codec.encode(values, value, this->codec.size());
+	if (key_size + value.size() > MAX_KEY_SZ)
+		throw DbRelationError("entry too big for index " + this->name);
+	return value;
+}
+
+// What bulk_load gets from the KeySorter: the key, the value and then the key's size (2 bytes).
+// No key is the start of another, so these sort the same as the keys do.
+string BTreeIndex::sort_entry(const string& key, const string& value) {
+	string entry = key + value;
+	entry.push_back((char)(key.size() >> 8));
+	entry.push_back((char)key.size());
+	return entry;
+}
+
+// What to look for: the given values of the leading key columns.
+string BTreeIndex::search_key(const ValueDict* key_values) const {
+	string key;
+	if (this->codec.encode(this->key_columns, key_values, key) == 0)
+		throw DbRelationError("index " + this->name + " needs a value for " + this->key_columns[0]);
+	return key;
+}
+
+// Handles of the entries from the first key not less than from, for as long as the start of the key
+// is not greater than through (or to the end if through is nullptr).
+Handles* BTreeIndex::scan(const string& from, const string* through) const {
+	Handles* handles = new Handles();
+	try {
+		walk(from, through, [handles](const TextView& key, const TextView& value) {
+			handles->push_back(KeyCodec::get_handle(key.get_data(), key.get_size()));
+		});
+	} catch (...) {
+		delete handles;
+		throw;
+	}
+	return handles;
+}
+
+// The range walked is the entries that start with where's values for the leading key columns; the
+// rest of where is checked against each entry's values. A value of a different type than its column
+// matches nothing, as in a relation's scan.
+void BTreeIndex::scan(const ValueDict* where, const ColumnNames& column_names, RowVisitor visit) const {
+	ColumnNames covered = this->key_columns;
+	covered.insert(covered.end(), this->include_columns.begin(), this->include_columns.end());
+	ColumnOrdinals positions;
+	for (auto const& column_name: column_names)
+		positions.push_back(covered_position(covered, column_name));
+	ValueDict everything;
+	if (where == nullptr)
+		where = &everything;
+	uint key_size = this->codec.size();
+	for (auto const& column: *where) {
+		uint position = covered_position(covered, column.first);
+		if (position < key_size ? !this->codec.accepts(position, column.second)
+				: !this->include_codec.accepts(position - key_size, column.second))
+			return;
+	}
+	string prefix;
+	uint leading = this->codec.encode(this->key_columns, where, prefix);
+	vector<pair<uint, Value>> checks;
+	for (auto const& column: *where) {
+		uint position = covered_position(covered, column.first);
+		if (position >= leading)
+			checks.push_back(make_pair(position, column.second));
+	}
+
+	Row entry((uint)covered.size()), row((uint)column_names.size());
+	walk(prefix, leading == 0 ? nullptr : &prefix, [&](const TextView& key, const TextView& value) {
+		entry.clear();
+		this->codec.decode(key.get_data(), key.get_size() - KeyCodec::HANDLE_SZ, &entry);
+		this->include_codec.decode(value.get_data(), value.get_size(), &entry, key_size);
+		for (auto const& check: checks)
+			if (!matches(entry, check.first, check.second))
+				return;
+		for (uint i = 0; i < positions.size(); i++) {
+			uint at = positions[i];
+			ColumnAttribute::DataType data_type = entry.get_data_type(at);
+			if (entry.is_null(at)) {
+				row.set_null(i, data_type);
+			} else if (data_type == ColumnAttribute::TEXT) {
+				TextView text = entry.get_text(at);
+				row.borrow_text(i, text.get_data(), text.get_size());
+			} else {
+				row.set_int(i, entry.get_int(at), data_type);
+			}
+		}
+		visit(KeyCodec::get_handle(key.get_data(), key.get_size()), row);
+	});
+}
+
+bool BTreeIndex::covers(const ColumnNames& column_names) const {
+	for (auto const& column_name: column_names)
+		if (find(this->key_columns.begin(), this->key_columns.end(), column_name) == this->key_columns.end()
+				&& find(this->include_columns.begin(), this->include_columns.end(), column_name)
+						== this->include_columns.end())
+			return false;
+	return true;
+}
+
+// Visit the entries from the first key not less than from, for as long as the start of the key is
+// not greater than through (or to the end if through is nullptr). The key and value are only good
+// during the call. Each leaf is copied (see read_node) and visited from the copy, so nothing is
+// pinned or locked while visit runs.
+void BTreeIndex::walk(const string& from, const string* through, EntryVisitor visit) const {
+	const_cast<BTreeIndex*>(this)->open();
+	char* copy = new char[DbBlock::BLOCK_SZ];
+	try {
+		Path path;
+		descend(from, path, copy);
+		BTreeNode leaf(copy, path.back().first);
+		uint i = leaf.lower_bound(from);
+		string key;
+		while (true) {
+			for (; i < leaf.size(); i++) {
+				leaf.get_key(i, key);
+				if (through != nullptr && key.compare(0, through->size(), *through) > 0) {
+					delete[] copy;
+					return;
+				}
+				visit(key, leaf.value(i));
+			}
+			BlockID next = leaf.get_link();
+			if (next == 0)
+				break;
+			uint64_t version;
+			while (!read_node(next, copy, version))
+				;
+			i = 0;
+		}
+	} catch (...) {
+		delete[] copy;
+		throw;
+	}
+	delete[] copy;
+}
+
+// Where a column is among the key columns and then the included ones.
+uint BTreeIndex::covered_position(const ColumnNames& covered, const Identifier& column_name) const {
+	for (uint i = 0; i < covered.size(); i++)
+		if (covered[i] == column_name)
+			return i;
+	throw DbRelationError("index " + this->name + " does not have column " + column_name);
+}
+
+// Same test as a where clause in a relation's scan: equal values, or both NULL.
+bool BTreeIndex::matches(const Row& row, uint i, const Value& value) {
+	if (row.is_null(i) || value.is_null)
+		return row.is_null(i) && value.is_null;
+	if (row.get_data_type(i) == ColumnAttribute::TEXT)
+		return row.get_text(i) == TextView(value.s);
+	return row.get_int(i) == value.n;
+}
+
+// Copy a node's block, returning false if it changed while being copied. The version is the one
+// the copy is of.
+bool BTreeIndex::read_node(BlockID block_id, char* copy, uint64_t& version) const {
+	version = this->versions.read_lock(block_id);
+	char* bytes = _BUFFER_POOL->pin(&this->db, block_id);
+	memcpy(copy, bytes, DbBlock::BLOCK_SZ);
+	_BUFFER_POOL->unpin(&this->db, block_id);
+	return this->versions.validate(block_id, version);
+}
+
+// Go down to the leaf where the key is (or would go) without locking anything. Each node is copied
+// (into copy, which ends up with the leaf) and then its parent's version checked again, so the
+// node really was the parent's child; if anything changed, it starts over from the root. Path gets
+// the stat block (its version covers root and height) and then each node on the way, root first.
+void BTreeIndex::descend(const string& key, Path& path, char* copy) const {
+	while (true) {
+		path.clear();
+		path.push_back(make_pair(STAT_BLOCK, this->versions.read_lock(STAT_BLOCK)));
+		BlockID block_id = this->root;
+		uint level = this->height;
+		while (true) {
+			uint64_t version;
+			if (!read_node(block_id, copy, version) || !this->versions.validate(path.back().first, path.back().second))
+				break;
+			path.push_back(make_pair(block_id, version));
+			if (level-- <= 1)
+				return;
+			block_id = BTreeNode(copy, block_id).find(key);
+		}
+	}
+}
+
+// Find the leaf for the key (see descend) and lock it at the version it was seen at, starting over
+// if it has changed since. The path still has the leaf's ancestors and their versions.
+BTreeNode* BTreeIndex::lock_leaf(const string& key, Path& path) {
+	char* copy = new char[DbBlock::BLOCK_SZ];
+	try {
+		do {
+			descend(key, path, copy);
+		} while (!this->versions.upgrade(path.back().first, path.back().second));
+	} catch (...) {
+		delete[] copy;
+		throw;
+	}
+	delete[] copy;
+	try {
+		return get(path.back().first);
+	} catch (...) {
+		unlock(path, 1);
+		throw;
+	}
+}
+
+// Lock the locked leaf's ancestors (at the versions they were seen at), from its parent up to the
+// first one that can take any separator without splitting, or through the stat block if the root
+// might split. Returns how many of the path's nodes are locked, leaf included, or if one of them
+// has changed since, unlocks them all (leaf included) and returns 0.
+uint BTreeIndex::lock_ancestors(const Path& path) {
+	uint locked = 1;
+	for (uint j = (uint)path.size() - 1; j-- > 0; ) {
+		if (!this->versions.upgrade(path[j].first, path[j].second)) {
+			unlock(path, locked);
+			return 0;
+		}
+		locked++;
+		if (j == 0)
+			break;
+		BTreeNode* ancestor = get(path[j].first);
+		bool has_room = ancestor->has_room_for(MAX_KEY_SZ, sizeof(BlockID));
+		delete ancestor;
+		if (has_room)
+			break;
+	}
+	return locked;
+}
+
+// Unlock the last n nodes of the path.
+void BTreeIndex::unlock(const Path& path, uint n) {
+	for (uint j = (uint)path.size() - n; j < path.size(); j++)
+		this->versions.unlock(path[j].first);
+}
+
+// Check the unique constraint and put the entry in.
+void BTreeIndex::add(const string& key, const string& value, bool any_null) {
+	open();
+	if (this->unique && !any_null) {
+		lock_guard<mutex> lock(this->unique_latch);
+		string values = key.substr(0, key.size() - KeyCodec::HANDLE_SZ);
+		Handles* same = scan(values, &values);
+		bool duplicate = !same->empty();
+		delete same;
+		if (duplicate)
+			throw DbRelationError("duplicate key for unique index " + this->name);
+		insert_entry(key, value);
+		return;
+	}
+	insert_entry(key, value);
+}
+
+// Take an entry out of its leaf.
+void BTreeIndex::remove_entry(const string& key) {
+	Path path;
+	BTreeNode* leaf = lock_leaf(key, path);
+	uint i = leaf->lower_bound(key);
+	bool found = i < leaf->size() && leaf->key(i) == key;
+	if (found) {
+		leaf->remove(i);
+		leaf->mark_dirty();
+	}
+	delete leaf;
+	unlock(path, 1);
+	if (!found)
+		throw DbRelationError("record is not in index " + this->name);
+}
+
+// Pack the sorted entries into leaves, and then build each level of interior nodes over the one below,
+// until a level is just one node, the root. Each node's entries are collected until the next one
+// would take it (prefix-compressed) past fill, and then it is built in memory and written once.
+void BTreeIndex::bulk_load(KeySorter& entries) {
+	uint fill = max((uint)(fill_factor * DbBlock::BLOCK_SZ), BTreeNode::HEADER_SZ + 6 + MAX_KEY_SZ);
+	char* bytes = new char[DbBlock::BLOCK_SZ];
+	BTreeNode::Entries page;  // entries of the node being filled
+	uint page_bytes = 0;
+	BlockID block_id = 0;
+	vector<pair<string, BlockID>> level;  // each node of the level and the least key under it
+	try {
+		string entry, key, value, previous;
+		while (entries.next(entry)) {
+			uint key_size = ((uint)(unsigned char)entry[entry.size() - 2] << 8) | (unsigned char)entry[entry.size() - 1];
+			key.assign(entry, 0, key_size);
+			value.assign(entry, key_size, entry.size() - 2 - key_size);
+			if (this->unique && !previous.empty()) {
+				uint size = (uint)key.size() - KeyCodec::HANDLE_SZ;
+				if (previous.compare(0, previous.size() - KeyCodec::HANDLE_SZ, key, 0, size) == 0
+						&& !this->codec.has_null(key.data(), size))
+					throw DbRelationError("duplicate key for unique index " + this->name);
+			}
+			uint entry_bytes = (uint)(key.size() + value.size());
+			if (block_id == 0) {
+				block_id = ++this->last;
+				level.push_back(make_pair("", block_id));
+			} else if (BTreeNode::packed_size((uint)page.size() + 1, page_bytes + entry_bytes,
+					BTreeNode::common_prefix(page.front().first, key)) > fill) {
+				put_new(block_id, true, block_id + 1, page, bytes);  // the leaves are consecutive
+				page.clear();
+				page_bytes = 0;
+				block_id = ++this->last;
+				level.push_back(make_pair(separator(previous, key), block_id));
+			}
+			page.push_back(make_pair(key, value));
+			page_bytes += entry_bytes;
+			previous.swap(key);
+		}
+		if (block_id == 0) {
+			block_id = ++this->last;
+			level.push_back(make_pair("", block_id));
+		}
+		put_new(block_id, true, 0, page, bytes);
+		this->height = 1;
+
+		while (level.size() > 1) {
+			vector<pair<string, BlockID>> above;
+			BlockID leftmost = 0;
+			block_id = 0;
+			for (auto const& child: level) {
+				string value((const char*)&child.second, sizeof(child.second));
+				uint entry_bytes = (uint)(child.first.size() + value.size());
+				if (block_id == 0 || (!page.empty() && BTreeNode::packed_size((uint)page.size() + 1,
+						page_bytes + entry_bytes, BTreeNode::common_prefix(page.front().first, child.first)) > fill)) {
+					if (block_id != 0)
+						put_new(block_id, false, leftmost, page, bytes);
+					page.clear();
+					page_bytes = 0;
+					block_id = ++this->last;
+					leftmost = child.second;
+					above.push_back(make_pair(child.first, block_id));
+					continue;
+				}
+				page.push_back(make_pair(child.first, value));
+				page_bytes += entry_bytes;
+			}
+			put_new(block_id, false, leftmost, page, bytes);
+			page.clear();
+			page_bytes = 0;
+			level.swap(above);
+			this->height++;
+		}
+	} catch (...) {
+		delete[] bytes;
+		throw;
+	}
+	delete[] bytes;
+	this->root = level[0].second;
+}
+
+// Build a node in memory (in bytes) and write it as the given (new) block of the file.
+void BTreeIndex::put_new(BlockID block_id, bool is_leaf, BlockID link, const BTreeNode::Entries& entries, char* bytes) {
+	BTreeNode node(bytes, block_id, is_leaf);
+	node.set_link(link);
+	node.load(entries);
+	Dbt key(&block_id, sizeof(block_id));
+	Dbt data((void*)bytes, DbBlock::BLOCK_SZ);
+	this->db.put(nullptr, &key, &data, 0);
+}
+
+// Put an entry in its leaf. Usually only the leaf is locked; if it has to split, so are the
+// ancestors the split can reach (see lock_ancestors).
+void BTreeIndex::insert_entry(const string& key, const string& value) {
+	while (true) {
+		Path path;
+		BTreeNode* node = lock_leaf(key, path);
+		uint i = node->lower_bound(key);
+		if (i < node->size() && node->key(i) == key) {
+			delete node;
+			unlock(path, 1);
+			throw DbRelationError("record is already in index " + this->name);
+		}
+		if (node->has_room(key, (uint)value.size())) {
+			node->insert(i, key, value);
+			node->mark_dirty();
+			delete node;
+			unlock(path, 1);
+			return;
+		}
+		uint locked;
+		try {
+			locked = lock_ancestors(path);
+		} catch (...) {
+			delete node;
+			unlock(path, 1);
+			throw;
+		}
+		if (locked == 0) {
+			delete node;
+			continue;
+		}
+		try {
+			insert_up(node, i, key, value, path);
+		} catch (...) {
+			unlock(path, locked);
+			throw;
+		}
+		unlock(path, locked);
+		return;
+	}
+}
+
+// Put an entry in as entry at of the (locked) node at the end of the path, splitting it and then
+// its ancestors on the way back up as needed. Deletes node.
+void BTreeIndex::insert_up(BTreeNode* node, uint at, const string& key, const string& value, const Path& path) {
+	string entry_key = key, entry_value = value;
+	uint level = (uint)path.size() - 1;
+	while (true) {
+		if (node->has_room(entry_key, (uint)entry_value.size())) {
+			node->insert(at, entry_key, entry_value);
+			node->mark_dirty();
+			delete node;
+			return;
+		}
+		string separator;
+		BlockID right;
+		try {
+			split(node, at, entry_key, entry_value, separator, right);
+		} catch (...) {
+			delete node;
+			throw;
+		}
+		delete node;
+		entry_key = separator;
+		entry_value = string((const char*)&right, sizeof(right));
+		if (--level == 0)
+			break;
+		node = get(path[level].first);
+		at = node->lower_bound(entry_key);
+	}
+
+	// the root split, so the tree gets a new root over the two halves
+	BTreeNode* new_root = get_new(false);
+	new_root->set_link(this->root);
+	new_root->insert(0, entry_key, entry_value);
+	this->root = new_root->get_block_id();
+	this->height++;
+	delete new_root;
+	write_stat();
+}
+
+// Split a full node, with a new entry going in at the given position, in two where the halves come
+// out closest in size (each with the prefix its own keys share). The upper half moves to a new node
+// (right) and separator is the key that goes in the parent for it. For leaves, that is just enough of
+// the right node's first key to be greater than the left node's last; an interior node's middle
+// entry moves up to the parent instead, its child becoming the right node's leftmost child.
+void BTreeIndex::split(BTreeNode* node, uint at, const string& key, const string& value, string& separator,
+		BlockID& right) {
+	BTreeNode::Entries entries;
+	for (uint i = 0; i <= node->size(); i++) {
+		if (i == at)
+			entries.push_back(make_pair(key, value));
+		if (i < node->size())
+			entries.push_back(make_pair(node->key(i), node->value(i).str()));
+	}
+	uint n = (uint)entries.size();
+	bool is_leaf = node->is_leaf();
+	vector<uint> before(n + 1, 0);  // bytes of the entries before each one
+	for (uint i = 0; i < n; i++)
+		before[i + 1] = before[i] + (uint)(entries[i].first.size() + entries[i].second.size());
+	uint k = 1, best = ~0U;
+	for (uint i = 1; i <= (is_leaf ? n - 1 : n - 2); i++) {
+		uint first_right = is_leaf ? i : i + 1;
+		uint left = BTreeNode::packed_size(i, before[i],
+				BTreeNode::common_prefix(entries[0].first, entries[i - 1].first));
+		uint right = BTreeNode::packed_size(n - first_right, before[n] - before[first_right],
+				BTreeNode::common_prefix(entries[first_right].first, entries[n - 1].first));
+		if (max(left, right) < best)
+			best = max(left, right), k = i;
+	}
+
+	BTreeNode* sibling = get_new(is_leaf);
+	uint first_right = k;
+	if (is_leaf) {
+		sibling->set_link(node->get_link());
+		node->set_link(sibling->get_block_id());
+		separator = BTreeIndex::separator(entries[k - 1].first, entries[k].first);
+	} else {
+		BlockID leftmost;
+		memcpy(&leftmost, entries[k].second.data(), sizeof(leftmost));
+		sibling->set_link(leftmost);
+		separator = entries[k].first;
+		first_right = k + 1;
+	}
+	try {
+		node->load(BTreeNode::Entries(entries.begin(), entries.begin() + k));
+		sibling->load(BTreeNode::Entries(entries.begin() + first_right, entries.end()));
+	} catch (...) {
+		delete sibling;
+		throw;
+	}
+	node->mark_dirty();
+	sibling->mark_dirty();
+	right = sibling->get_block_id();
+	delete sibling;
+}
+
+// The shortest start of right that is still greater than left (which is less than right). It is
+// all a parent needs to send keys to the right node or the left one.
+string BTreeIndex::separator(const string& left, const string& right) {
+	return right.substr(0, BTreeNode::common_prefix(left, right) + 1);
+}
+
+
+/*
+ * *******************
+ * Testing
+ * *******************
+ */
+
+// test function -- returns true if all tests pass
+bool test_btree() {
+	ColumnNames column_names;
+	column_names.push_back("a");
+	column_names.push_back("b");
+	ColumnAttributes column_attributes;
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	HeapTable table("_test_btree_cpp", column_names, column_attributes);
+	table.create();
+
+	// a goes down as the rows go in, so the index sees the keys in the opposite order from the table
+	const int N = 3000;
+	map<int, Handle> by_a;
+	ValueDict row;
+	for (int i = 0; i < N; i++) {
+		row["a"] = Value(N - i);
+		row["b"] = Value("name" + to_string(i % 100));
+		by_a[N - i] = table.insert(&row);
+	}
+
+	ColumnNames just_a(1, "a"), b_then_a;
+	b_then_a.push_back("b");
+	b_then_a.push_back("a");
+	BTreeIndex index(table, "fxa", just_a, true);
+	index.create();
+	BTreeIndex by_b(table, "fxb", b_then_a, false);
+	size_t sort_memory = BTreeIndex::sort_memory;
+	BTreeIndex::sort_memory = 4096;  // so the entries get sorted in several runs
+	by_b.create();
+	BTreeIndex::sort_memory = sort_memory;
+	if (index.get_height() < 2)
+		return false;
+	BTreeIndex not_unique(table, "fxbu", ColumnNames(1, "b"), true);
+	bool refused = false;
+	try {
+		not_unique.create();
+	} catch (DbRelationError& e) {
+		refused = true;
+	}
+	if (!refused)
+		return false;
+	cout << "btree create ok (height " << index.get_height() << ")" << endl;
+
+	ValueDict key;
+	for (int a = 1; a <= N; a += 97) {
+		key["a"] = Value(a);
+		u_long pins = _BUFFER_POOL->get_hits() + _BUFFER_POOL->get_misses();
+		Handles* handles = index.lookup(&key);
+		pins = _BUFFER_POOL->get_hits() + _BUFFER_POOL->get_misses() - pins;
+		bool found = handles->size() == 1 && (*handles)[0] == by_a[a] && pins <= index.get_height() + 1;
+		delete handles;
+		if (!found)
+			return false;
+	}
+	key["a"] = Value(N + 1);
+	Handles* handles = index.lookup(&key);
+	bool missing = handles->empty();
+	delete handles;
+	if (!missing)
+		return false;
+	cout << "btree lookup ok" << endl;
+
+	ValueDict min_key, max_key;
+	min_key["a"] = Value(100);
+	max_key["a"] = Value(199);
+	handles = index.range(&min_key, &max_key);
+	bool in_order = handles->size() == 100;
+	for (uint i = 0; in_order && i < handles->size(); i++)
+		in_order = (*handles)[i] == by_a[100 + (int)i];
+	delete handles;
+	key.clear();
+	key["b"] = Value("name7");
+	handles = by_b.lookup(&key);
+	in_order = in_order && handles->size() == N / 100;
+	for (uint i = 0; in_order && i < handles->size(); i++)
+		in_order = (*handles)[i] == by_a[N - 7 - 100 * ((int)handles->size() - 1 - (int)i)];
+	delete handles;
+	if (!in_order)
+		return false;
+	cout << "btree range ok" << endl;
+
+	row["a"] = Value(5);
+	Handle duplicate = table.insert(&row);
+	refused = false;
+	try {
+		index.insert(duplicate);
+	} catch (DbRelationError& e) {
+		refused = true;
+	}
+	table.del(duplicate);
+	if (!refused)
+		return false;
+	cout << "btree unique ok" << endl;
+
+	for (int a = 1; a <= 100; a++) {
+		index.del(by_a[a]);
+		by_b.del(by_a[a]);
+		table.del(by_a[a]);
+		by_a.erase(a);
+	}
+	for (int a = N + 1; a <= 2 * N; a++) {
+		row["a"] = Value(a);
+		row["b"] = Value("name" + to_string(a % 100));
+		by_a[a] = table.insert(&row);
+		index.insert(by_a[a]);
+		by_b.insert(by_a[a]);
+	}
+	min_key["a"] = Value(1);
+	max_key["a"] = Value(2 * N);
+	handles = index.range(&min_key, &max_key);
+	bool all_there = handles->size() == by_a.size();
+	uint i = 0;
+	for (auto const& entry: by_a)
+		all_there = all_there && (*handles)[i++] == entry.second;
+	delete handles;
+	handles = by_b.range(nullptr, nullptr);
+	all_there = all_there && handles->size() == by_a.size();
+	delete handles;
+	if (!all_there)
+		return false;
+	cout << "btree insert/del ok (height " << index.get_height() << ")" << endl;
+
+	// once the table has them, its inserts, updates and deletes keep them up to date
+	table.add_index(&index);
+	table.add_index(&by_b);
+	row["a"] = Value(-1);
+	Handle handle = table.insert(&row);
+	ValueDict new_values;
+	new_values["a"] = Value(-2);
+	table.update(handle, &new_values);
+	key.clear();
+	key["a"] = Value(-1);
+	handles = index.lookup(&key);
+	bool kept = handles->empty();
+	delete handles;
+	new_values["a"] = Value(200);  // already taken
+	refused = false;
+	try {
+		table.update(handle, &new_values);
+	} catch (DbRelationError& e) {
+		refused = true;
+	}
+	key["a"] = Value(-2);
+	handles = index.lookup(&key);
+	kept = kept && refused && handles->size() == 1 && (*handles)[0] == handle;
+	delete handles;
+	// fill up the row's block (and any before it), so that making the row longer moves it and its
+	// index entries
+	Handles fillers;
+	ValueDict filler;
+	filler["b"] = Value("filler");
+	do {
+		filler["a"] = Value(-1000 - (int)fillers.size());
+		fillers.push_back(table.insert(&filler));
+	} while (fillers.back().first <= handle.first);
+	new_values.clear();
+	new_values["b"] = Value(string(600, 'm'));
+	Handle moved = table.update(handle, &new_values);
+	handles = index.lookup(&key);
+	kept = kept && moved != handle && handles->size() == 1 && (*handles)[0] == moved;
+	delete handles;
+	key.clear();
+	key["b"] = new_values["b"];
+	handles = by_b.lookup(&key);
+	kept = kept && handles->size() == 1 && (*handles)[0] == moved;
+	delete handles;
+	handle = moved;
+	for (auto const& filler_handle: fillers)
+		table.del(filler_handle);
+	key.clear();
+	key["a"] = Value(-2);
+	table.del(handle);
+	handles = index.lookup(&key);
+	kept = kept && handles->empty();
+	delete handles;
+
+	ValueDicts batch;
+	for (int a = -100; a > -150; a--) {
+		ValueDict* batch_row = new ValueDict();
+		(*batch_row)["a"] = Value(a);
+		(*batch_row)["b"] = Value("batch");
+		batch.push_back(batch_row);
+	}
+	(*batch.back())["a"] = Value(-100);  // so none of them go in
+	refused = false;
+	try {
+		delete table.insert_many(&batch);
+	} catch (DbRelationError& e) {
+		refused = true;
+	}
+	key.clear();
+	key["b"] = Value("batch");
+	handles = by_b.lookup(&key);
+	kept = kept && refused && handles->empty();
+	delete handles;
+	(*batch.back())["a"] = Value(-149);
+	// a row in the middle that can't be stored leaves the table and its indices as they were
+	Handles* rows_before = table.select();
+	Handles* entries_before = by_b.range(nullptr, nullptr);
+	for (uint too_big: {DbBlock::BLOCK_SZ - 8, DbBlock::BLOCK_SZ + 1}) {
+		(*batch[batch.size() / 2])["b"] = Value(string(too_big, 'x'));
+		refused = false;
+		try {
+			delete table.insert_many(&batch);
+		} catch (DbRelationError& e) {
+			refused = true;
+		}
+		Handles* after = table.select();
+		handles = by_b.range(nullptr, nullptr);
+		kept = kept && refused && *after == *rows_before && *handles == *entries_before;
+		delete after;
+		delete handles;
+	}
+	delete rows_before;
+	delete entries_before;
+	(*batch[batch.size() / 2])["b"] = Value("batch");
+	delete table.insert_many(&batch);
+	handles = by_b.lookup(&key);
+	kept = kept && handles->size() == batch.size();
+	delete handles;
+	for (auto batch_row: batch)
+		delete batch_row;
+	table.remove_index(&index);
+	table.remove_index(&by_b);
+	if (!kept)
+		return false;
+	cout << "btree maintenance ok" << endl;
+
+	// b, with a included, has everything a query on a and b needs
+	BTreeIndex covering(table, "fxbc", ColumnNames(1, "b"), false, just_a);
+	covering.create();
+	b_then_a.push_back("c");
+	bool index_only = covering.covers(just_a) && !covering.covers(b_then_a);
+	key.clear();
+	key["b"] = Value("name7");
+	handles = by_b.lookup(&key);
+	uint n = 0;
+	covering.scan(&key, just_a, [&](Handle handle, const Row& values) {
+		Row* row = table.project_row(handle, table.column_ordinals(&just_a));
+		index_only = index_only && find(handles->begin(), handles->end(), handle) != handles->end()
+				&& row->get_int(0) == values.get_int(0);
+		n++;
+		delete row;
+	});
+	index_only = index_only && n == handles->size();
+	delete handles;
+	key.clear();
+	key["a"] = Value(200);
+	n = 0;
+	covering.scan(&key, ColumnNames(1, "b"), [&](Handle handle, const Row& values) {
+		index_only = index_only && handle == by_a[200] && values.get_text(0) == TextView("name0");
+		n++;
+	});
+	// changing just an included column still changes the index's entry
+	table.add_index(&covering);
+	ValueDict new_a;
+	new_a["a"] = Value(-300);
+	index_only = index_only && table.update(by_a[200], &new_a) == by_a[200];
+	table.remove_index(&covering);
+	key["a"] = Value(-300);
+	covering.scan(&key, ColumnNames(1, "b"), [&](Handle handle, const Row& values) {
+		index_only = index_only && handle == by_a[200];
+		n++;
+	});
+	new_a["a"] = Value(200);
+	table.update(by_a[200], &new_a);
+	// a value of the wrong type matches nothing, as in the table's own scan
+	key.clear();
+	key["a"] = Value("200");
+	covering.scan(&key, ColumnNames(1, "b"), [&](Handle handle, const Row& values) {
+		n++;
+	});
+	key.clear();
+	key["b"] = Value(0);
+	covering.scan(&key, just_a, [&](Handle handle, const Row& values) {
+		n++;
+	});
+	covering.drop();
+	if (!index_only || n != 2)
+		return false;
+	cout << "btree index-only scan ok" << endl;
+
+	// keys that all start alike are stored once per node, and separators are only a few bytes long,
+	// so a node holds many of them even though each key is long
+	HeapTable long_keys("_test_btree_cpp_prefix", ColumnNames(1, "c"),
+			ColumnAttributes(1, ColumnAttribute(ColumnAttribute::TEXT)));
+	long_keys.create();
+	string common(300, 'x');
+	ValueDict long_row;
+	vector<Handle> long_handles;
+	for (int i = 0; i < N; i++) {
+		long_row["c"] = Value(common + to_string(100000 + i));
+		long_handles.push_back(long_keys.insert(&long_row));
+	}
+	BTreeIndex by_c(long_keys, "fxc", ColumnNames(1, "c"), true);
+	by_c.create();
+	bool compressed = by_c.get_height() == 2;
+	for (int i = N; compressed && i < N + 1000; i++) {  // and splits keep it that way
+		long_row["c"] = Value(common + to_string(100000 + i));
+		long_handles.push_back(long_keys.insert(&long_row));
+		by_c.insert(long_handles.back());
+	}
+	compressed = compressed && by_c.get_height() == 2;
+	for (int i = 0; compressed && i < N + 1000; i += 37) {
+		key.clear();
+		key["c"] = Value(common + to_string(100000 + i));
+		handles = by_c.lookup(&key);
+		compressed = handles->size() == 1 && (*handles)[0] == long_handles[i];
+		delete handles;
+	}
+	by_c.drop();
+	long_keys.drop();
+	if (!compressed)
+		return false;
+	cout << "btree prefix compression ok (height " << by_c.get_height() << ")" << endl;
+
+	// two threads take entries out and put them back while two others look up ones nobody touches
+	handles = by_b.range(nullptr, nullptr);
+	size_t before = handles->size();
+	delete handles;
+	vector<Handle> moving;
+	for (int a = 1000; a < 1400; a++)
+		moving.push_back(by_a.at(a));
+	atomic<bool> concurrent(true);
+	auto writer = [&](uint first) {
+		try {
+			for (int round = 0; round < 5; round++)
+				for (uint i = first; i < first + 200; i++) {
+					by_b.del(moving[i]);
+					by_b.insert(moving[i]);
+				}
+		} catch (DbRelationError& e) {
+			concurrent = false;
+		}
+	};
+	auto reader = [&]() {
+		try {
+			for (int round = 0; round < 5; round++)
+				for (int a = 2000; a < 2400; a++) {
+					ValueDict where;
+					where["b"] = Value("name" + to_string((N - a) % 100));
+					where["a"] = Value(a);
+					Handles* found = by_b.lookup(&where);
+					if (found->size() != 1 || (*found)[0] != by_a.at(a))
+						concurrent = false;
+					delete found;
+				}
+		} catch (DbRelationError& e) {
+			concurrent = false;
+		}
+	};
+	vector<thread> threads;
+	threads.push_back(thread(writer, 0));
+	threads.push_back(thread(writer, 200));
+	threads.push_back(thread(reader));
+	threads.push_back(thread(reader));
+	for (auto& thread: threads)
+		thread.join();
+	handles = by_b.range(nullptr, nullptr);
+	bool all_back = concurrent && handles->size() == before;
+	delete handles;
+	if (!all_back)
+		return false;
+	cout << "btree concurrency ok" << endl;
+
+	index.drop();
+	by_b.drop();
+	table.drop();
+	return true;
+}
+
+// Lookups (or operations, with a tenth of them a del and insert again) per second for each number
+// of threads.
+static double bench_threads(BTreeIndex& index, const vector<Handle>& handles, uint threads, bool writes) {
+	const uint OPS = 200000;
+	auto start = chrono::steady_clock::now();
+	vector<thread> workers;
+	for (uint t = 0; t < threads; t++)
+		workers.push_back(thread([&index, &handles, threads, writes, t, OPS]() {
+			ValueDict key;
+			uint n = (uint)handles.size();
+			for (uint i = 0; i < OPS / threads; i++) {
+				uint k = (uint)(((uint64_t)(i + t * OPS) * 2654435761U) % n);
+				if (writes && i % 10 == 0) {
+					Handle mine = handles[(k / threads) * threads + t];  // no two threads move the same entry
+					index.del(mine);
+					index.insert(mine);
+					continue;
+				}
+				key["a"] = Value((int)k);
+				delete index.lookup(&key);
+			}
+		}));
+	for (auto& worker: workers)
+		worker.join();
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return seconds > 0.0 ? OPS / seconds : 0.0;
+}
+
+void bench_btree() {
+	const uint ROWS = 100000;
+	ColumnNames column_names(1, "a");
+	ColumnAttributes column_attributes(1, ColumnAttribute(ColumnAttribute::INT));
+	HeapTable table("_bench_btree_cpp", column_names, column_attributes);
+	table.create();
+	vector<Handle> handles;
+	ValueDict row;
+	for (uint i = 0; i < ROWS; i++) {
+		row["a"] = Value((int)i);
+		handles.push_back(table.insert(&row));
+	}
+	BTreeIndex index(table, "bxa", column_names, false);
+	index.create();
+	cout << "btree of " << ROWS << " keys (height " << index.get_height() << "), per second:" << endl;
+	for (uint threads = 1; threads <= 8; threads *= 2)
+		cout << "  " << threads << (threads == 1 ? " thread" : " threads")
+			 << ": lookups " << (u_long)bench_threads(index, handles, threads, false)
+			 << ", 10% writes " << (u_long)bench_threads(index, handles, threads, true) << endl;
+	index.drop();
+	table.drop();
+}
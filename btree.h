@@ -0,0 +1,405 @@
+/**
+ * @file btree.h - Implementation of storage_engine's DbIndex with a B+tree.
+ * BTreeNode
+ * BTreeIndex: DbIndex
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <queue>
+#include "db_cxx.h"
+#include "storage_engine.h"
+
+/**
+ * @class BTreeNode - one node of a B+tree, kept in a block pinned in the buffer pool.
+ * Deleting it releases the pin.
+ *
+ *      The block starts with a header:
+ *          Byte  0x00:        1 for a leaf, 0 for an interior node
+ *          Bytes 0x02 - 0x03: number of entries
+ *          Bytes 0x04 - 0x05: offset to the first byte of the cells (they are packed at the end of the block)
+ *          Bytes 0x06 - 0x07: bytes of cells left behind by remove (reclaimed when the block is compacted)
+ *          Bytes 0x08 - 0x0b: leaf: next leaf (0 for the last one); interior: leftmost child
+ *          Bytes 0x0c - 0x0d: size of the prefix every key in the node starts with
+ *      followed by the prefix bytes and then the offset of each entry's cell (2 bytes apiece) in key
+ *      order. A cell is the size of the rest of the key (after the prefix) and the value's size (2 bytes
+ *      each) and then those bytes. Keys are compared against a node's prefix once and then against
+ *      the cells' parts in place, so a search doesn't put any key back together.
+ *
+ *      Leaf keys are KeyCodec keys with the record's handle on the end, so they are all distinct,
+ *      and leaf values are the KeyCodec encoding of the index's included columns (empty if it has
+ *      none). An interior node's values are child BlockIDs: entry i's child has
+ *      the keys from key i up to (not including) key i+1 and the leftmost child has those less
+ *      than key 0.
+ */
+class BTreeNode {
+public:
+	static const uint HEADER_SZ = 14;
+	typedef std::vector<std::pair<std::string, std::string>> Entries;  // keys (whole) and values
+
+	BTreeNode(Db* db, BlockID block_id, bool is_new=false, bool is_leaf=true);
+
+	/**
+	 * A new node built in the given memory instead of in the buffer pool (see BTreeIndex::create).
+	 */
+	BTreeNode(char* bytes, BlockID block_id, bool is_leaf);
+
+	/**
+	 * A node over a copy of its block made elsewhere (see BTreeIndex::read_node).
+	 */
+	BTreeNode(char* bytes, BlockID block_id);
+	virtual ~BTreeNode();
+	BTreeNode(const BTreeNode& other) = delete;
+	BTreeNode(BTreeNode&& temp) = delete;
+	BTreeNode& operator=(const BTreeNode& other) = delete;
+	BTreeNode& operator=(BTreeNode&& temp) = delete;
+
+	BlockID get_block_id() const {return block_id;}
+	bool is_leaf() const {return bytes[0] != 0;}
+
+	/**
+	 * @returns  number of entries
+	 */
+	uint size() const {return get_n(2);}
+
+	/**
+	 * The prefix all of the keys have, and what is left of key i after it
+	 */
+	TextView prefix() const {return TextView(bytes + HEADER_SZ, get_n(12));}
+	TextView suffix(uint i) const;
+
+	/**
+	 * Key i (prefix and suffix put together)
+	 */
+	std::string key(uint i) const;
+	void get_key(uint i, std::string& key) const;
+	TextView value(uint i) const;
+
+	/**
+	 * @returns  entry i's child (interior nodes)
+	 */
+	BlockID child(uint i) const;
+
+	/**
+	 * Leaf: the next leaf. Interior: the leftmost child.
+	 */
+	BlockID get_link() const;
+	void set_link(BlockID block_id);
+
+	/**
+	 * @returns  the first entry whose key is not less than the given key (size() if none)
+	 */
+	uint lower_bound(const TextView& key) const;
+
+	/**
+	 * Which child of an interior node to go down to find the given key (or the first key after it).
+	 */
+	BlockID find(const TextView& key) const;
+
+	/**
+	 * @returns  bytes not used by the header, the cell offsets or the cells
+	 */
+	uint free_space() const;
+
+	/**
+	 * Would the entry fit (after compacting, if necessary)? A key without the node's whole prefix
+	 * needs room for the prefix to be shortened, too.
+	 */
+	bool has_room(const TextView& key, uint value_size) const;
+
+	/**
+	 * Would any entry with a key of up to key_size bytes fit, whatever the key starts with?
+	 */
+	bool has_room_for(uint key_size, uint value_size) const;
+
+	/**
+	 * Put a new entry in as entry i.
+	 * @throws  DbBlockNoRoomError if it won't fit (see has_room)
+	 */
+	void insert(uint i, const TextView& key, const TextView& value);
+
+	/**
+	 * Replace the entries with the given ones (in key order), with the longest prefix they share.
+	 * @throws  DbBlockNoRoomError if they won't fit
+	 */
+	void load(const Entries& entries);
+
+	/**
+	 * Take out entry i.
+	 */
+	void remove(uint i);
+
+	/**
+	 * Take out every entry (leaving the link alone).
+	 */
+	void clear();
+
+	/**
+	 * @returns  how many bytes a node with the given entries would use, if their keys and values
+	 *           come to entry_bytes and they share a prefix of prefix_size bytes
+	 */
+	static uint packed_size(uint entries, uint entry_bytes, uint prefix_size);
+
+	/**
+	 * @returns  how many bytes a and b start with that are the same
+	 */
+	static uint common_prefix(const TextView& a, const TextView& b);
+
+	/**
+	 * Note that the node has changed, so the buffer pool has to write it back.
+	 */
+	void mark_dirty();
+
+protected:
+	Db* db;
+	BlockID block_id;
+	char* bytes;
+
+	uint get_n(uint offset) const;
+	void put_n(uint offset, uint n);
+	uint slots() const {return HEADER_SZ + get_n(12);}
+	uint cell(uint i) const {return get_n(slots() + 2 * i);}
+	void compact();
+	void rebuild(const Entries& entries, uint prefix_size);
+};
+
+/**
+ * @class KeySorter - sorts more keys than fit in memory
+ *
+ * Keys are collected in memory until they take up the given number of bytes, then sorted and written
+ * out to a temporary file as a run. Reading them back (with next) merges the runs, or if there were
+ * none, just goes through the sorted keys in memory.
+ */
+class KeySorter {
+public:
+	KeySorter(size_t memory);
+	virtual ~KeySorter();
+	KeySorter(const KeySorter& other) = delete;
+	KeySorter(KeySorter&& temp) = delete;
+	KeySorter& operator=(const KeySorter& other) = delete;
+	KeySorter& operator=(KeySorter&& temp) = delete;
+
+	/**
+	 * Add a key (only before the first call to next).
+	 */
+	virtual void add(const std::string& key);
+
+	/**
+	 * Get the next key in sorted order.
+	 * @param key  set to the key
+	 * @returns    false once there are no more keys
+	 */
+	virtual bool next(std::string& key);
+
+	/**
+	 * @returns  number of runs that were written out
+	 */
+	virtual uint get_runs() const {return (uint)runs.size();}
+
+protected:
+	typedef std::pair<std::string, uint> Head;  // next key of a run, and which run
+
+	size_t memory;
+	size_t used;
+	std::vector<std::string> keys;
+	size_t position;
+	std::vector<FILE*> runs;
+	std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+	bool sorted;
+
+	virtual void spill();
+	virtual bool read(uint run, std::string& key);
+};
+
+/**
+ * @class NodeVersions - a version counter for each block of a file, for optimistic lock coupling
+ *
+ * An odd version means a writer has the block locked. Locking and unlocking each add one, so a
+ * reader that sees the same even version before and after it looks at a block knows nobody changed
+ * it in between. The counters are made a chunk at a time as blocks are reached, and chunks never
+ * move, so they are used without a latch.
+ */
+class NodeVersions {
+public:
+	NodeVersions();
+	virtual ~NodeVersions();
+	NodeVersions(const NodeVersions& other) = delete;
+	NodeVersions(NodeVersions&& temp) = delete;
+	NodeVersions& operator=(const NodeVersions& other) = delete;
+	NodeVersions& operator=(NodeVersions&& temp) = delete;
+
+	/**
+	 * @returns  the block's version, once no writer has it locked (waits until then)
+	 */
+	virtual uint64_t read_lock(BlockID block_id);
+
+	/**
+	 * @returns  true if the block is still at the given version
+	 */
+	virtual bool validate(BlockID block_id, uint64_t version);
+
+	/**
+	 * Lock the block if it is still at the given version.
+	 * @returns  true if it is now locked
+	 */
+	virtual bool upgrade(BlockID block_id, uint64_t version);
+
+	virtual void unlock(BlockID block_id);
+
+protected:
+	static const uint CHUNK_SZ = 1024;
+	static const uint MAX_CHUNKS = 4096;
+
+	std::atomic<std::atomic<uint64_t>*> chunks[MAX_CHUNKS];
+
+	virtual std::atomic<uint64_t>& at(BlockID block_id);
+};
+
+/**
+ * @class BTreeIndex - DbIndex implementation with a B+tree kept in its own file
+ *
+ * The tree's blocks go through the buffer pool. Block 1 of the file has the tree's root, height and
+ * FORMAT; the nodes (see BTreeNode) are the rest. Each record gets a leaf entry whose key is its
+ * KeyCodec key plus its handle, so the leaves are in key order (and handle order within a key),
+ * lookup and range are a descent from the root and a walk along the leaves, and insert and del
+ * touch one entry. A full node is split in two and the separating key is added to its parent (the
+ * root splitting makes the tree a level taller). The separator for two leaves is only as long as it
+ * needs to be to tell them apart (the shortest start of the right one's first key that is greater
+ * than the left one's last), and each node stores the prefix its keys share once (see BTreeNode),
+ * so TEXT keys with long common beginnings still give a node many entries and the tree few levels.
+ * Nodes emptied by del are left for later inserts to refill rather than merged with their
+ * neighbors.
+ *
+ * The values given to lookup and range can be just the leading columns of the key. For unique
+ * indices, insert refuses a record whose key is already there (unless the key has a NULL in it).
+ *
+ * An index can also have included columns, whose values are kept in each leaf entry but aren't part
+ * of the key. A query that only looks at key and included columns (see covers) can be answered by
+ * scan from the leaves alone, without reading any of the relation's rows.
+ *
+ * create builds the tree for the records already in the relation from the bottom up: the entries
+ * are sorted (see KeySorter) and packed into leaves in order, each filled to fill_factor, then each
+ * level of interior nodes is built over the one below it, so every node is written once, the
+ * leaves are in consecutive blocks, and there's room left for later inserts.
+ *
+ * lookup, range, scan, insert and del can be called from several threads at once, using optimistic
+ * lock coupling (see NodeVersions). Readers lock nothing: each node on the way down is copied and
+ * the copy used only if the node's version (and its parent's) didn't change meanwhile, starting
+ * over from the root if either did. A writer goes down the same way and then locks just the leaf
+ * at the version it saw, plus, if the leaf has to split, each ancestor up to the first with room
+ * for any separator. Since nodes are never merged, a leaf that splits only moves entries to a new
+ * right sibling, so a reader following the leaf links never misses or repeats an entry. Inserts
+ * into a unique index are serialized, so that their duplicate checks can't miss each other.
+ * create, drop and close must not run alongside anything else.
+ */
+class BTreeIndex : public DbIndex {
+public:
+	/**
+	 * Biggest entry (key with the handle, plus included values) there can be, so that a node always
+	 * fits several entries
+	 */
+	static const uint MAX_KEY_SZ = 1000;
+
+	BTreeIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique,
+			ColumnNames include_columns=ColumnNames());
+	virtual ~BTreeIndex();
+	BTreeIndex(const BTreeIndex& other) = delete;
+	BTreeIndex(BTreeIndex&& temp) = delete;
+	BTreeIndex& operator=(const BTreeIndex& other) = delete;
+	BTreeIndex& operator=(BTreeIndex&& temp) = delete;
+
+	virtual void create();
+	virtual void drop();
+	virtual void open();
+	virtual void close();
+	virtual Handles* lookup(ValueDict* key_values) const;
+	virtual Handles* range(ValueDict* min_key, ValueDict* max_key) const;
+	virtual void insert(Handle record);
+	virtual void insert_many(const Handles* records);
+	virtual void del(Handle record);
+	virtual bool covers(const ColumnNames& column_names) const;
+	virtual void scan(const ValueDict* where, const ColumnNames& column_names, RowVisitor visit) const;
+
+	/**
+	 * How full create makes each node (the rest is room for later inserts)
+	 */
+	static double fill_factor;
+
+	/**
+	 * Most memory (in bytes) create uses to sort the entries before it sorts them in runs
+	 */
+	static size_t sort_memory;
+
+	/**
+	 * @returns  number of levels (a tree that is just a leaf has height 1)
+	 */
+	virtual uint get_height() const {return height;}
+
+protected:
+	static const uint32_t STAT_BLOCK = 1;
+	static const uint32_t FORMAT = 1;  // node layout, kept in the stat block (files from before it have 0)
+	typedef std::function<void(const TextView& key, const TextView& value)> EntryVisitor;
+
+	typedef std::vector<std::pair<BlockID, uint64_t>> Path;  // nodes and the versions they were seen at
+
+	std::string dbfilename;
+	std::atomic<bool> closed;
+	mutable Db db;
+	std::atomic<BlockID> root;
+	std::atomic<uint> height;
+	BlockID last;
+	mutable NodeVersions versions;
+	std::mutex open_latch;
+	std::mutex allocate_latch;  // protects last (after create)
+	std::mutex unique_latch;
+	KeyCodec codec;
+	KeyCodec include_codec;
+	ColumnOrdinals key_ordinals;
+	ColumnOrdinals entry_ordinals;  // key columns, then included columns
+
+	virtual void db_open(uint flags=0);
+	virtual void write_stat();
+	virtual BTreeNode* get(BlockID block_id) const;
+	virtual BTreeNode* get_new(bool is_leaf);
+	virtual BlockID allocate();
+	virtual std::string entry_key(const Row& key_values, Handle record, bool* any_null=nullptr) const;
+	virtual std::string entry_value(const Row& values, uint key_size) const;
+	virtual std::string search_key(const ValueDict* key_values) const;
+	virtual Handles* scan(const std::string& from, const std::string* through) const;
+	virtual void walk(const std::string& from, const std::string* through, EntryVisitor visit) const;
+	virtual uint covered_position(const ColumnNames& covered, const Identifier& column_name) const;
+	virtual bool read_node(BlockID block_id, char* copy, uint64_t& version) const;
+	virtual void descend(const std::string& key, Path& path, char* copy) const;
+	virtual BTreeNode* lock_leaf(const std::string& key, Path& path);
+	virtual uint lock_ancestors(const Path& path);
+	virtual void unlock(const Path& path, uint n);
+	virtual void add(const std::string& key, const std::string& value, bool any_null);
+	virtual void remove_entry(const std::string& key);
+	virtual void bulk_load(KeySorter& entries);
+	virtual void put_new(BlockID block_id, bool is_leaf, BlockID link, const BTreeNode::Entries& entries, char* bytes);
+	virtual void insert_entry(const std::string& key, const std::string& value);
+	virtual void insert_up(BTreeNode* node, uint at, const std::string& key, const std::string& value,
+			const Path& path);
+	virtual void split(BTreeNode* node, uint at, const std::string& key, const std::string& value,
+			std::string& separator, BlockID& right);
+
+	static std::string sort_entry(const std::string& key, const std::string& value);
+	static std::string separator(const std::string& left, const std::string& right);
+	static bool matches(const Row& row, uint i, const Value& value);
+};
+
+/**
+ * Test BTreeIndex.
+ * @returns  true if all the tests pass
+ */
+bool test_btree();
+
+/**
+ * Lookups per second (and lookups mixed with inserts and deletes) in a BTreeIndex shared by
+ * different numbers of threads.
+ */
+void bench_btree();
@@ -0,0 +1,279 @@
+/**
+ * @file buffer_pool.cpp - implementation of:
+ * BufferPool
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#include <chrono>
+#include <memory.h>
+#include "buffer_pool.h"
+using namespace std;
+
+BufferPool* _BUFFER_POOL = nullptr;
+
+BufferPool::BufferPool(uint num_frames) : frames(num_frames), memory(nullptr), page_table(), clock_hand(0),
+		hits(0), misses(0), writes(0), prefetches(0), read_ns(0.0), stopping(false) {
+	if (num_frames == 0)
+		throw BufferPoolError("buffer pool needs at least one frame");
+	this->memory = new char[(size_t)num_frames * DbBlock::BLOCK_SZ];
+	for (uint i = 0; i < num_frames; i++) {
+		Frame& frame = this->frames[i];
+		frame.db = nullptr;
+		frame.block_id = 0;
+		frame.pin_count = 0;
+		frame.dirty = false;
+		frame.referenced = false;
+		frame.loading = false;
+		frame.data = this->memory + (size_t)i * DbBlock::BLOCK_SZ;
+	}
+}
+
+BufferPool::~BufferPool() {
+	{
+		lock_guard<mutex> lock(this->latch);
+		this->stopping = true;
+	}
+	this->work.notify_all();
+	if (this->prefetcher.joinable())
+		this->prefetcher.join();
+	delete[] this->memory;
+}
+
+// Pin the block, bringing it into a frame first if necessary.
+char* BufferPool::pin(Db* db, BlockID block_id, bool read) {
+	unique_lock<mutex> lock(this->latch);
+	while (true) {
+		auto found = this->page_table.find(FrameKey(db, block_id));
+		if (found == this->page_table.end())
+			break;
+		Frame& frame = this->frames[found->second];
+		if (frame.loading) {
+			// someone (probably the prefetcher) is already reading it in
+			this->loaded.wait(lock);
+			continue;
+		}
+		frame.pin_count++;
+		frame.referenced = true;
+		this->hits++;
+		if (!read)
+			memset(frame.data, 0, DbBlock::BLOCK_SZ);
+		return frame.data;
+	}
+	this->misses++;
+	return this->frames[load(lock, db, block_id, read, true)].data;
+}
+
+void BufferPool::unpin(Db* db, BlockID block_id) {
+	lock_guard<mutex> lock(this->latch);
+	Frame& frame = find(db, block_id);
+	if (frame.pin_count == 0)
+		throw BufferPoolError("unpin of a block that is not pinned");
+	frame.pin_count--;
+}
+
+void BufferPool::mark_dirty(Db* db, BlockID block_id) {
+	lock_guard<mutex> lock(this->latch);
+	find(db, block_id).dirty = true;
+}
+
+void BufferPool::flush(Db* db) {
+	lock_guard<mutex> lock(this->latch);
+	for (auto& frame: this->frames)
+		if (frame.db == db && frame.dirty)
+			write(frame);
+}
+
+// Drop the file's frames on the floor. They had better not be pinned anymore.
+// Any read-ahead still queued for the file is cancelled, and we wait out any that is in progress.
+void BufferPool::discard(Db* db) {
+	unique_lock<mutex> lock(this->latch);
+	for (auto request = this->prefetch_queue.begin(); request != this->prefetch_queue.end(); )
+		if (request->first == db)
+			request = this->prefetch_queue.erase(request);
+		else
+			request++;
+	this->loaded.wait(lock, [this, db]() {
+		for (auto const& frame: this->frames)
+			if (frame.db == db && frame.loading)
+				return false;
+		return true;
+	});
+	for (auto& frame: this->frames)
+		if (frame.db == db) {
+			this->page_table.erase(FrameKey(frame.db, frame.block_id));
+			frame.db = nullptr;
+			frame.dirty = false;
+			frame.pin_count = 0;
+			frame.referenced = false;
+		}
+}
+
+void BufferPool::flush_all() {
+	lock_guard<mutex> lock(this->latch);
+	for (auto& frame: this->frames)
+		if (frame.db != nullptr && frame.dirty)
+			write(frame);
+}
+
+// Queue the blocks for the prefetcher thread (starting it the first time).
+void BufferPool::prefetch(Db* db, BlockID first, BlockID last) {
+	{
+		lock_guard<mutex> lock(this->latch);
+		for (BlockID block_id = first; block_id <= last; block_id++)
+			if (this->page_table.find(FrameKey(db, block_id)) == this->page_table.end())
+				this->prefetch_queue.push_back(FrameKey(db, block_id));
+		if (!this->prefetcher.joinable())
+			this->prefetcher = thread(&BufferPool::run_prefetcher, this);
+	}
+	this->work.notify_one();
+}
+
+// Keep enough reads in flight to cover the read latency: latency/consumption rate, plus the one
+// being consumed. Never tie up more than a quarter of the pool.
+uint BufferPool::readahead_window(double consume_ns) const {
+	lock_guard<mutex> lock(this->latch);
+	uint most = min((uint)MAX_READAHEAD, max(1U, (uint)this->frames.size() / 4));
+	if (this->read_ns == 0.0)
+		return min(2U, most);  // nothing read yet
+	if (consume_ns < 1.0)
+		return most;
+	double window = this->read_ns / consume_ns + 1.0;
+	return window >= most ? most : max(1U, (uint)window);
+}
+
+u_long BufferPool::get_hits() const {
+	lock_guard<mutex> lock(this->latch);
+	return this->hits;
+}
+
+u_long BufferPool::get_misses() const {
+	lock_guard<mutex> lock(this->latch);
+	return this->misses;
+}
+
+u_long BufferPool::get_writes() const {
+	lock_guard<mutex> lock(this->latch);
+	return this->writes;
+}
+
+u_long BufferPool::get_prefetches() const {
+	lock_guard<mutex> lock(this->latch);
+	return this->prefetches;
+}
+
+// Get the frame currently holding the given block. Latch must be held.
+BufferPool::Frame& BufferPool::find(Db* db, BlockID block_id) {
+	auto found = this->page_table.find(FrameKey(db, block_id));
+	if (found == this->page_table.end())
+		throw BufferPoolError("block " + to_string(block_id) + " is not in the buffer pool");
+	return this->frames[found->second];
+}
+
+// Claim a frame for the block and fill it. The read itself is done with the latch released;
+// anyone else who wants the block meanwhile waits for the frame's loading flag to clear.
+// Latch must be held (by lock) on entry and is held again on return.
+uint BufferPool::load(unique_lock<mutex>& lock, Db* db, BlockID block_id, bool read, bool pin) {
+	uint i = victim();
+	Frame& frame = this->frames[i];
+	if (frame.db != nullptr) {
+		if (frame.dirty)
+			write(frame);
+		this->page_table.erase(FrameKey(frame.db, frame.block_id));
+	}
+	frame.db = db;
+	frame.block_id = block_id;
+	frame.dirty = false;
+	frame.pin_count = pin ? 1 : 0;
+	frame.referenced = true;
+	this->page_table[FrameKey(db, block_id)] = i;
+	if (!read) {
+		memset(frame.data, 0, DbBlock::BLOCK_SZ);
+		return i;
+	}
+
+	frame.loading = true;
+	lock.unlock();
+	bool ok = true;
+	string error;
+	auto start = chrono::steady_clock::now();
+	try {
+		this->read(frame);
+	} catch (exception& e) {
+		ok = false;
+		error = e.what();
+	}
+	double ns = (double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+	lock.lock();
+
+	frame.loading = false;
+	this->read_ns = this->read_ns == 0.0 ? ns : 0.875 * this->read_ns + 0.125 * ns;
+	if (!ok) {
+		this->page_table.erase(FrameKey(db, block_id));
+		frame.db = nullptr;
+		frame.pin_count = 0;
+	}
+	this->loaded.notify_all();
+	if (!ok)
+		throw BufferPoolError(error);
+	return i;
+}
+
+// Clock replacement: sweep past pinned frames, giving recently referenced ones a second chance.
+// Latch must be held.
+uint BufferPool::victim() {
+	uint n = (uint)this->frames.size();
+	for (uint tries = 0; tries < 2*n; tries++) {
+		uint i = this->clock_hand;
+		this->clock_hand = (this->clock_hand + 1) % n;
+		Frame& frame = this->frames[i];
+		if (frame.pin_count > 0 || frame.loading)
+			continue;
+		if (frame.db != nullptr && frame.referenced) {
+			frame.referenced = false;
+			continue;
+		}
+		return i;
+	}
+	throw BufferPoolError("all " + to_string(n) + " buffer frames are pinned");
+}
+
+// Read the frame's block straight into the frame from its file.
+void BufferPool::read(Frame& frame) {
+	BlockID block_id = frame.block_id;
+	Dbt key(&block_id, sizeof(block_id));
+	Dbt data(frame.data, DbBlock::BLOCK_SZ);
+	data.set_ulen(DbBlock::BLOCK_SZ);
+	data.set_flags(DB_DBT_USERMEM);
+	if (frame.db->get(nullptr, &key, &data, 0) != 0)
+		throw BufferPoolError("block " + to_string(block_id) + " does not exist");
+}
+
+// Write the frame's block back to its file. Latch must be held.
+void BufferPool::write(Frame& frame) {
+	BlockID block_id = frame.block_id;
+	Dbt key(&block_id, sizeof(block_id));
+	Dbt data(frame.data, DbBlock::BLOCK_SZ);
+	frame.db->put(nullptr, &key, &data, 0);
+	frame.dirty = false;
+	this->writes++;
+}
+
+// Body of the prefetcher thread: read in whatever has been queued, oldest first.
+void BufferPool::run_prefetcher() {
+	unique_lock<mutex> lock(this->latch);
+	while (true) {
+		this->work.wait(lock, [this]() { return this->stopping || !this->prefetch_queue.empty(); });
+		if (this->stopping)
+			return;
+		FrameKey request = this->prefetch_queue.front();
+		this->prefetch_queue.pop_front();
+		if (this->page_table.find(request) != this->page_table.end())
+			continue;  // got there on its own
+		try {
+			load(lock, request.first, request.second, true, false);
+			this->prefetches++;
+		} catch (exception& e) {
+			// no free frame or no such block; the scan will just read it itself
+		}
+	}
+}
@@ -0,0 +1,171 @@
+/**
+ * @file buffer_pool.h - Buffer manager for the blocks of our Berkeley DB RecNo files.
+ * BufferPool
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "db_cxx.h"
+#include "storage_engine.h"
+
+/**
+ * @class BufferPoolError - exception for BufferPool methods
+ */
+class BufferPoolError : public DbRelationError {
+public:
+	explicit BufferPoolError(std::string s) : DbRelationError(s) {}
+};
+
+/**
+ * @class BufferPool - fixed-size cache of DbBlock::BLOCK_SZ frames in front of our files
+ *
+ * A block is identified by the Berkeley DB handle of its (RecNo) file plus its BlockID. Callers
+ * pin a block to get at its bytes in a frame, and unpin it when they are done. A frame is only
+ * reused once nothing has it pinned; the victim is picked with the clock algorithm and written
+ * back first if it is dirty. So repeated access to a hot block costs a hash lookup instead of a
+ * Berkeley DB get/put with a copy of the whole block each way.
+ *
+ * Modified blocks are only written when evicted or flushed, so files must be flushed before
+ * their Db handle is closed (and discarded once the file is removed).
+ *
+ * The pool can also read blocks ahead of a sequential scan: prefetch() queues blocks for a
+ * background thread to bring in (unpinned) while the scan is busy with the current block.
+ * The pool is thread-safe; reads happen outside the pool's latch so other threads can keep
+ * hitting the cache, and the Db handles must be opened with DB_THREAD.
+ */
+class BufferPool {
+public:
+	/**
+	 * Default number of frames (1MB worth of blocks)
+	 */
+	static const uint DEFAULT_FRAMES = 256;
+
+	/**
+	 * Most blocks a single scan may have queued for read-ahead
+	 */
+	static const uint MAX_READAHEAD = 64;
+
+	BufferPool(uint num_frames=DEFAULT_FRAMES);
+	virtual ~BufferPool();
+	BufferPool(const BufferPool& other) = delete;
+	BufferPool(BufferPool&& temp) = delete;
+	BufferPool& operator=(const BufferPool& other) = delete;
+	BufferPool& operator=(BufferPool&& temp) = delete;
+
+	/**
+	 * Pin a block into a frame, reading it from its file if it isn't already in one.
+	 * @param db        the file's Berkeley DB handle
+	 * @param block_id  which block
+	 * @param read      false for a brand-new block: the frame is zeroed instead of read
+	 * @returns         the frame's bytes, valid until the matching unpin
+	 * @throws          BufferPoolError if every frame is pinned or the block can't be read
+	 */
+	virtual char* pin(Db* db, BlockID block_id, bool read=true);
+
+	/**
+	 * Release one pin on a block.
+	 * @param db        the file's Berkeley DB handle
+	 * @param block_id  which block
+	 */
+	virtual void unpin(Db* db, BlockID block_id);
+
+	/**
+	 * Note that a (pinned) block has been modified and must be written back.
+	 * @param db        the file's Berkeley DB handle
+	 * @param block_id  which block
+	 */
+	virtual void mark_dirty(Db* db, BlockID block_id);
+
+	/**
+	 * Write back all the dirty blocks of the given file.
+	 * @param db  the file's Berkeley DB handle
+	 */
+	virtual void flush(Db* db);
+
+	/**
+	 * Forget all the blocks of the given file without writing them (e.g., it is being removed).
+	 * @param db  the file's Berkeley DB handle
+	 */
+	virtual void discard(Db* db);
+
+	/**
+	 * Write back every dirty block in the pool.
+	 */
+	virtual void flush_all();
+
+	/**
+	 * Ask the background thread to bring a run of blocks into the pool (without pinning them).
+	 * Blocks already in the pool are skipped. Returns right away.
+	 * @param db     the file's Berkeley DB handle
+	 * @param first  first block to read
+	 * @param last   last block to read
+	 */
+	virtual void prefetch(Db* db, BlockID first, BlockID last);
+
+	/**
+	 * How many blocks a sequential scan should keep queued ahead of itself so that the reads
+	 * finish before it gets to them: enough to cover the observed read latency at the scan's
+	 * observed rate of consumption.
+	 * @param consume_ns  how long the scan spends on each block (nanoseconds)
+	 * @returns           number of blocks to read ahead (at least 1)
+	 */
+	virtual uint readahead_window(double consume_ns) const;
+
+	// statistics
+	virtual uint get_size() const {return (uint)frames.size();}
+	virtual u_long get_hits() const;
+	virtual u_long get_misses() const;
+	virtual u_long get_writes() const;
+	virtual u_long get_prefetches() const;
+
+protected:
+	struct Frame {
+		Db* db;             // nullptr if the frame is free
+		BlockID block_id;
+		uint pin_count;
+		bool dirty;
+		bool referenced;    // clock bit
+		bool loading;       // being read in (outside the latch)
+		char* data;
+	};
+	typedef std::pair<Db*, BlockID> FrameKey;
+	struct FrameKeyHash {
+		size_t operator()(const FrameKey& key) const {
+			return std::hash<void*>()(key.first) ^ (std::hash<BlockID>()(key.second) * 0x9e3779b1U);
+		}
+	};
+
+	std::vector<Frame> frames;
+	char* memory;
+	std::unordered_map<FrameKey, uint, FrameKeyHash> page_table;
+	uint clock_hand;
+	u_long hits, misses, writes, prefetches;
+	double read_ns;  // moving average of how long a block read takes
+
+	mutable std::mutex latch;               // protects everything above
+	std::condition_variable loaded;         // signaled when a frame finishes loading
+	std::condition_variable work;           // signaled when there are prefetch requests (or we're stopping)
+	std::deque<FrameKey> prefetch_queue;
+	std::thread prefetcher;
+	bool stopping;
+
+	virtual Frame& find(Db* db, BlockID block_id);
+	virtual uint load(std::unique_lock<std::mutex>& lock, Db* db, BlockID block_id, bool read, bool pin);
+	virtual uint victim();
+	virtual void read(Frame& frame);
+	virtual void write(Frame& frame);
+	virtual void run_prefetcher();
+};
+
+/**
+ * Global variable to hold the buffer pool that all our files share.
+ */
+extern BufferPool* _BUFFER_POOL;
@@ -0,0 +1,582 @@
+/**
+ * @file hash_index.cpp - implementation of:
+ * HashBucket
+ * HashIndex
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#include <memory.h>
+#include <algorithm>
+#include <iostream>
+#include "hash_index.h"
+#include "buffer_pool.h"
+#include "heap_storage.h"
+using namespace std;
+
+typedef uint16_t u16;
+
+
+/*
+ * *******************
+ * HashBucket class
+ * *******************
+ */
+
+HashBucket::HashBucket(Db* db, BlockID block_id, bool is_new, uint local_depth) : db(db), block_id(block_id),
+		bytes(nullptr) {
+	this->bytes = _BUFFER_POOL->pin(db, block_id, !is_new);
+	if (is_new) {
+		memset(this->bytes, 0, HEADER_SZ);
+		set_local_depth(local_depth);
+		clear();
+		mark_dirty();
+	}
+}
+
+HashBucket::~HashBucket() {
+	_BUFFER_POOL->unpin(this->db, this->block_id);
+}
+
+BlockID HashBucket::get_next() const {
+	BlockID block_id;
+	memcpy(&block_id, this->bytes + 8, sizeof(block_id));
+	return block_id;
+}
+
+void HashBucket::set_next(BlockID block_id) {
+	memcpy(this->bytes + 8, &block_id, sizeof(block_id));
+}
+
+uint32_t HashBucket::hash(uint at) const {
+	uint32_t hash;
+	memcpy(&hash, this->bytes + at, sizeof(hash));
+	return hash;
+}
+
+void HashBucket::add(uint32_t hash, const TextView& key) {
+	if (!has_room(key.get_size()))
+		throw DbBlockNoRoomError("not enough room for new index entry");
+	uint at = get_n(4);
+	memcpy(this->bytes + at, &hash, sizeof(hash));
+	put_n(at + 4, key.get_size());
+	memcpy(this->bytes + at + 6, key.get_data(), key.get_size());
+	put_n(4, at + 6 + key.get_size());
+	put_n(2, size() + 1);
+}
+
+void HashBucket::remove(uint at) {
+	uint entry_size = 6 + get_n(at + 4);
+	uint end = get_n(4);
+	memmove(this->bytes + at, this->bytes + at + entry_size, end - at - entry_size);
+	put_n(4, end - entry_size);
+	put_n(2, size() - 1);
+}
+
+void HashBucket::clear() {
+	put_n(2, 0);
+	put_n(4, HEADER_SZ);
+}
+
+void HashBucket::mark_dirty() {
+	_BUFFER_POOL->mark_dirty(this->db, this->block_id);
+}
+
+uint HashBucket::get_n(uint offset) const {
+	return *(u16*)(this->bytes + offset);
+}
+
+void HashBucket::put_n(uint offset, uint n) {
+	*(u16*)(this->bytes + offset) = (u16)n;
+}
+
+
+/*
+ * *******************
+ * HashIndex class
+ * *******************
+ */
+
+const uint HashIndex::DIRECTORY_ENTRIES;  // min takes it by reference
+
+HashIndex::HashIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique) :
+		DbIndex(relation, name, key_columns, unique), dbfilename(""), closed(true), db(_DB_ENV, 0),
+		global_depth(0), bucket_count(0), last(0), directory(), directory_pages(), codec(), key_ordinals() {
+	if (this->key_columns.empty() || this->key_columns.size() > MAX_COMPOSITE)
+		throw DbRelationError("index " + name + " must have 1 to " + to_string(MAX_COMPOSITE) + " columns");
+	this->dbfilename = relation.get_table_name() + "-" + name + ".hash";
+	this->key_ordinals = relation.column_ordinals(&this->key_columns);
+	ColumnAttributes column_attributes = relation.get_column_attributes();
+	ColumnAttributes key_attributes;
+	for (auto ordinal: this->key_ordinals)
+		key_attributes.push_back(column_attributes[ordinal]);
+	this->codec = KeyCodec(key_attributes);
+}
+
+// Write back anything the buffer pool still has of ours before our Db handle goes away.
+HashIndex::~HashIndex() {
+	close();
+}
+
+// Start with a directory of one entry and one empty bucket, and then add the relation's records.
+// If that fails (e.g., a key too big for the index), the file is removed again.
+void HashIndex::create() {
+	db_open(DB_CREATE|DB_EXCL);
+	try {
+		this->last = 0;
+		allocate();  // STAT_BLOCK
+		this->directory_pages.assign(1, allocate());
+		HashBucket* bucket = get_new(0);
+		this->directory.assign(1, bucket->get_block_id());
+		delete bucket;
+		this->global_depth = 0;
+		this->bucket_count = 1;
+		write_directory(0, 0);
+		write_stat();
+
+		this->relation.scan(nullptr, this->key_ordinals, [this](Handle handle, const Row& row) {
+			bool any_null;
+			string key = entry_key(row, handle, &any_null);
+			add(key, any_null);
+		});
+	} catch (...) {
+		drop();
+		throw;
+	}
+}
+
+// Remove the file.
+void HashIndex::drop() {
+	if (!this->closed) {
+		_BUFFER_POOL->discard(&this->db);
+		this->db.close(0);
+		this->closed = true;
+	}
+	Db db(_DB_ENV, 0);
+	db.remove(this->dbfilename.c_str(), nullptr, 0);
+}
+
+// Open the file and read in the directory.
+void HashIndex::open() {
+	if (!this->closed)
+		return;
+	db_open();
+	char* stat = _BUFFER_POOL->pin(&this->db, STAT_BLOCK);
+	BlockID page;
+	memcpy(&this->global_depth, stat, 4);
+	memcpy(&this->bucket_count, stat + 4, 4);
+	memcpy(&page, stat + 8, 4);
+	_BUFFER_POOL->unpin(&this->db, STAT_BLOCK);
+
+	uint entries = 1U << this->global_depth;
+	this->directory.resize(entries);
+	this->directory_pages.clear();
+	for (uint first = 0; first < entries; first += DIRECTORY_ENTRIES) {
+		char* bytes = _BUFFER_POOL->pin(&this->db, page);
+		memcpy(&this->directory[first], bytes + 4, 4 * min(DIRECTORY_ENTRIES, entries - first));
+		this->directory_pages.push_back(page);
+		BlockID next;
+		memcpy(&next, bytes, 4);
+		_BUFFER_POOL->unpin(&this->db, page);
+		page = next;
+	}
+}
+
+void HashIndex::close() {
+	if (this->closed)
+		return;
+	_BUFFER_POOL->flush(&this->db);
+	_BUFFER_POOL->discard(&this->db);
+	this->db.close(0);
+	this->closed = true;
+}
+
+Handles* HashIndex::lookup(ValueDict* key_values) const {
+	string values;
+	if (this->codec.encode(this->key_columns, key_values, values) != this->key_columns.size())
+		throw DbRelationError("hash index " + this->name + " needs a value for every key column");
+	return find(values, hash(values.data(), (uint)values.size()));
+}
+
+void HashIndex::insert(Handle record) {
+	Row* row = this->relation.project_row(record, this->key_ordinals);
+	bool any_null;
+	string key;
+	try {
+		key = entry_key(*row, record, &any_null);
+	} catch (...) {
+		delete row;
+		throw;
+	}
+	delete row;
+	add(key, any_null);
+}
+
+void HashIndex::del(Handle record) {
+	Row* row = this->relation.project_row(record, this->key_ordinals);
+	string key;
+	try {
+		key = entry_key(*row, record);
+	} catch (...) {
+		delete row;
+		throw;
+	}
+	delete row;
+
+	open();
+	uint32_t h = hash(key.data(), (uint)key.size() - KeyCodec::HANDLE_SZ);
+	BlockID block_id = this->directory[h & ((1U << this->global_depth) - 1)];
+	while (block_id != 0) {
+		HashBucket* bucket = get(block_id);
+		uint at = bucket->first_entry();
+		for (uint i = 0; i < bucket->size(); i++, at = bucket->next_entry(at))
+			if (bucket->hash(at) == h && bucket->key(at) == key) {
+				bucket->remove(at);
+				bucket->mark_dirty();
+				delete bucket;
+				return;
+			}
+		block_id = bucket->get_next();
+		delete bucket;
+	}
+	throw DbRelationError("record is not in index " + this->name);
+}
+
+// Wrapper for Berkeley DB open, which does both open and creation.
+void HashIndex::db_open(uint flags) {
+	if (!this->closed)
+		return;
+	this->db.set_re_len(DbBlock::BLOCK_SZ);
+	this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags|DB_THREAD, 0644);
+	this->closed = false;
+
+	DB_BTREE_STAT* stat;
+	this->db.stat(nullptr, &stat, DB_FAST_STAT);
+	this->last = stat->bt_ndata;
+	free(stat);
+}
+
+void HashIndex::write_stat() {
+	char* stat = _BUFFER_POOL->pin(&this->db, STAT_BLOCK);
+	memcpy(stat, &this->global_depth, 4);
+	memcpy(stat + 4, &this->bucket_count, 4);
+	memcpy(stat + 8, &this->directory_pages[0], 4);
+	_BUFFER_POOL->mark_dirty(&this->db, STAT_BLOCK);
+	_BUFFER_POOL->unpin(&this->db, STAT_BLOCK);
+}
+
+// Write the directory pages that hold entries first through last, adding pages to the chain as the
+// directory outgrows it.
+void HashIndex::write_directory(uint first, uint last) {
+	while (this->directory_pages.size() * DIRECTORY_ENTRIES < this->directory.size()) {
+		BlockID page = allocate();
+		BlockID previous = this->directory_pages.back();
+		char* bytes = _BUFFER_POOL->pin(&this->db, previous);
+		memcpy(bytes, &page, 4);
+		_BUFFER_POOL->mark_dirty(&this->db, previous);
+		_BUFFER_POOL->unpin(&this->db, previous);
+		this->directory_pages.push_back(page);
+	}
+	for (uint i = first / DIRECTORY_ENTRIES; i <= last / DIRECTORY_ENTRIES; i++) {
+		BlockID page = this->directory_pages[i];
+		uint from = i * DIRECTORY_ENTRIES;
+		uint count = min(DIRECTORY_ENTRIES, (uint)this->directory.size() - from);
+		char* bytes = _BUFFER_POOL->pin(&this->db, page);
+		memcpy(bytes + 4, &this->directory[from], 4 * count);
+		_BUFFER_POOL->mark_dirty(&this->db, page);
+		_BUFFER_POOL->unpin(&this->db, page);
+	}
+}
+
+// Add a block to the end of the file. It is written out right away so the file knows how many
+// blocks it has.
+BlockID HashIndex::allocate() {
+	BlockID block_id = ++this->last;
+	char* zeros = new char[DbBlock::BLOCK_SZ]();
+	Dbt key(&block_id, sizeof(block_id));
+	Dbt data(zeros, DbBlock::BLOCK_SZ);
+	this->db.put(nullptr, &key, &data, 0);
+	delete[] zeros;
+	return block_id;
+}
+
+// The bucket page in the given block (pinned until it is deleted).
+HashBucket* HashIndex::get(BlockID block_id) const {
+	return new HashBucket(&this->db, block_id);
+}
+
+HashBucket* HashIndex::get_new(uint local_depth) {
+	return new HashBucket(&this->db, allocate(), true, local_depth);
+}
+
+// A record's entry key: its key values and its handle.
+string HashIndex::entry_key(const Row& key_values, Handle record, bool* any_null) const {
+	string key;
+	bool has_null = this->codec.encode(key_values, key);
+	KeyCodec::append_handle(key, record);
+	if (key.size() > MAX_KEY_SZ)
+		throw DbRelationError("key too big for index " + this->name);
+	if (any_null != nullptr)
+		*any_null = has_null;
+	return key;
+}
+
+// Check the unique constraint and put the entry in its bucket, splitting the bucket first if it is
+// full and that would help, or else giving it another page.
+void HashIndex::add(const string& key, bool any_null) {
+	open();
+	uint32_t h = hash(key.data(), (uint)key.size() - KeyCodec::HANDLE_SZ);
+	if (this->unique && !any_null) {
+		Handles* same = find(key.substr(0, key.size() - KeyCodec::HANDLE_SZ), h);
+		bool duplicate = !same->empty();
+		delete same;
+		if (duplicate)
+			throw DbRelationError("duplicate key for unique index " + this->name);
+	}
+
+	while (true) {
+		uint slot = h & ((1U << this->global_depth) - 1);
+		HashBucket* bucket = get(this->directory[slot]);
+		uint local_depth = bucket->get_local_depth();
+		bool all_alike = true;  // do all the keys in the bucket have the same hash as the new one?
+		while (true) {
+			if (bucket->has_room((uint)key.size())) {
+				bucket->add(h, key);
+				bucket->mark_dirty();
+				delete bucket;
+				return;
+			}
+			uint at = bucket->first_entry();
+			for (uint i = 0; i < bucket->size() && all_alike; i++, at = bucket->next_entry(at))
+				all_alike = bucket->hash(at) == h;
+			BlockID next = bucket->get_next();
+			if (next == 0)
+				break;
+			delete bucket;
+			bucket = get(next);
+		}
+		if (all_alike || local_depth >= MAX_DEPTH) {
+			HashBucket* overflow = get_new(local_depth);
+			overflow->add(h, key);
+			overflow->mark_dirty();
+			bucket->set_next(overflow->get_block_id());
+			bucket->mark_dirty();
+			delete overflow;
+			delete bucket;
+			return;
+		}
+		delete bucket;
+		split(slot);
+	}
+}
+
+// Handles of the entries with the given key values.
+Handles* HashIndex::find(const string& values, uint32_t hash) const {
+	const_cast<HashIndex*>(this)->open();
+	Handles* handles = new Handles();
+	BlockID block_id = this->directory[hash & ((1U << this->global_depth) - 1)];
+	while (block_id != 0) {
+		HashBucket* bucket = get(block_id);
+		uint at = bucket->first_entry();
+		for (uint i = 0; i < bucket->size(); i++, at = bucket->next_entry(at)) {
+			TextView key = bucket->key(at);
+			if (bucket->hash(at) == hash && key.get_size() == values.size() + KeyCodec::HANDLE_SZ
+					&& memcmp(key.get_data(), values.data(), values.size()) == 0)
+				handles->push_back(KeyCodec::get_handle(key.get_data(), key.get_size()));
+		}
+		block_id = bucket->get_next();
+		delete bucket;
+	}
+	return handles;
+}
+
+// Split the bucket the given directory entry points to by the next bit of its keys' hashes: the
+// keys with the bit set move to a new bucket. The directory doubles first if the bucket was
+// already using every bit it has.
+void HashIndex::split(uint slot) {
+	BlockID old_id = this->directory[slot];
+	HashBucket* bucket = get(old_id);
+	uint local_depth = bucket->get_local_depth();
+	delete bucket;
+	bool doubled = local_depth == this->global_depth;
+	if (doubled) {
+		size_t entries = this->directory.size();
+		this->directory.resize(2 * entries);
+		copy(this->directory.begin(), this->directory.begin() + entries, this->directory.begin() + entries);
+		this->global_depth++;
+	}
+
+	// take everything out of the old bucket's pages
+	vector<pair<uint32_t, string>> staying, moving;
+	BlockID block_id = old_id;
+	while (block_id != 0) {
+		bucket = get(block_id);
+		uint at = bucket->first_entry();
+		for (uint i = 0; i < bucket->size(); i++, at = bucket->next_entry(at)) {
+			uint32_t h = bucket->hash(at);
+			((h >> local_depth) & 1 ? moving : staying).push_back(make_pair(h, bucket->key(at).str()));
+		}
+		bucket->clear();
+		if (block_id == old_id)
+			bucket->set_local_depth(local_depth + 1);
+		bucket->mark_dirty();
+		block_id = bucket->get_next();
+		delete bucket;
+	}
+
+	// and put them back, half of them in a new bucket
+	HashBucket* sibling = get_new(local_depth + 1);
+	BlockID new_id = sibling->get_block_id();
+	delete sibling;
+	fill(old_id, staying);
+	fill(new_id, moving);
+
+	uint first = (uint)this->directory.size(), last = 0;
+	for (uint i = 0; i < this->directory.size(); i++)
+		if (this->directory[i] == old_id && ((i >> local_depth) & 1) != 0) {
+			this->directory[i] = new_id;
+			first = min(first, i);
+			last = max(last, i);
+		}
+	if (doubled) {
+		first = 0;
+		last = (uint)this->directory.size() - 1;
+	}
+	write_directory(first, last);
+	this->bucket_count++;
+	write_stat();
+}
+
+// Add the entries to the (empty) bucket starting at the given block, reusing its pages and adding
+// more as needed.
+void HashIndex::fill(BlockID block_id, const vector<pair<uint32_t, string>>& entries) {
+	HashBucket* bucket = get(block_id);
+	for (auto const& entry: entries) {
+		if (!bucket->has_room((uint)entry.second.size())) {
+			BlockID next = bucket->get_next();
+			HashBucket* more;
+			if (next == 0) {
+				more = get_new(0);
+				bucket->set_next(more->get_block_id());
+			} else {
+				more = get(next);
+			}
+			bucket->mark_dirty();
+			delete bucket;
+			bucket = more;
+		}
+		bucket->add(entry.first, entry.second);
+	}
+	bucket->mark_dirty();
+	delete bucket;
+}
+
+// Hash of the key values (FNV-1a, with the bits mixed so that the low ones are good).
+uint32_t HashIndex::hash(const char* values, uint size) {
+	uint64_t h = TextView(values, size).hash();
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return (uint32_t)h;
+}
+
+
+/*
+ * *******************
+ * Testing
+ * *******************
+ */
+
+// test function -- returns true if all tests pass
+bool test_hash_index() {
+	ColumnNames column_names;
+	column_names.push_back("a");
+	column_names.push_back("b");
+	ColumnAttributes column_attributes;
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	HeapTable table("_test_hash_cpp", column_names, column_attributes);
+	table.create();
+
+	const int N = 3000;
+	map<int, Handle> by_a;
+	ValueDict row;
+	for (int i = 0; i < N; i++) {
+		row["a"] = Value(i);
+		row["b"] = Value("name" + to_string(i % 100));
+		by_a[i] = table.insert(&row);
+	}
+	HashIndex index(table, "fxa", ColumnNames(1, "a"), true);
+	index.create();
+	HashIndex by_b(table, "fxb", ColumnNames(1, "b"), false);
+	by_b.create();
+	if (index.get_bucket_count() < 2)
+		return false;
+	cout << "hash create ok (" << index.get_bucket_count() << " buckets)" << endl;
+
+	ValueDict key;
+	for (int a = 0; a < N; a += 7) {
+		key["a"] = Value(a);
+		u_long pins = _BUFFER_POOL->get_hits() + _BUFFER_POOL->get_misses();
+		Handles* handles = index.lookup(&key);
+		pins = _BUFFER_POOL->get_hits() + _BUFFER_POOL->get_misses() - pins;
+		bool found = handles->size() == 1 && (*handles)[0] == by_a[a] && pins <= 2;
+		delete handles;
+		if (!found)
+			return false;
+	}
+	key.clear();
+	key["b"] = Value("name42");
+	Handles* handles = by_b.lookup(&key);
+	bool found = handles->size() == N / 100;
+	delete handles;
+	if (!found)
+		return false;
+	cout << "hash lookup ok" << endl;
+
+	// lots of the same key makes a bucket overflow rather than split forever
+	row["b"] = Value("same");
+	vector<Handle> same;
+	for (int a = N; a < N + 500; a++) {
+		row["a"] = Value(a);
+		same.push_back(table.insert(&row));
+		by_b.insert(same.back());
+	}
+	key["b"] = Value("same");
+	handles = by_b.lookup(&key);
+	found = handles->size() == same.size();
+	delete handles;
+	row["a"] = Value(1);
+	Handle duplicate = table.insert(&row);
+	bool refused = false;
+	try {
+		index.insert(duplicate);
+	} catch (DbRelationError& e) {
+		refused = true;
+	}
+	table.del(duplicate);
+	if (!found || !refused || by_b.get_global_depth() > HashIndex::MAX_DEPTH)
+		return false;
+	cout << "hash overflow/unique ok" << endl;
+
+	for (auto const& handle: same) {
+		by_b.del(handle);
+		table.del(handle);
+	}
+	handles = by_b.lookup(&key);
+	found = handles->empty();
+	delete handles;
+	key.clear();
+	key["a"] = Value(10);
+	index.del(by_a[10]);
+	handles = index.lookup(&key);
+	found = found && handles->empty();
+	delete handles;
+	if (!found)
+		return false;
+	cout << "hash del ok" << endl;
+
+	index.drop();
+	by_b.drop();
+	table.drop();
+	return true;
+}
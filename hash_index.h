@@ -0,0 +1,173 @@
+/**
+ * @file hash_index.h - Implementation of storage_engine's DbIndex with extendible hashing.
+ * HashBucket
+ * HashIndex: DbIndex
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#pragma once
+
+#include "db_cxx.h"
+#include "storage_engine.h"
+
+/**
+ * @class HashBucket - one page of a hash index's bucket, kept in a block pinned in the buffer pool.
+ * Deleting it releases the pin.
+ *
+ *      The block starts with a header:
+ *          Bytes 0x00 - 0x01: local depth (how many low bits of the hash all of the bucket's keys share)
+ *          Bytes 0x02 - 0x03: number of entries
+ *          Bytes 0x04 - 0x05: offset to the end of the entries
+ *          Bytes 0x08 - 0x0b: next page of the bucket (0 for none)
+ *      followed by the entries, one after another: the key's hash (4 bytes), the key's size
+ *      (2 bytes) and the key (KeyCodec key values with the record's handle on the end).
+ */
+class HashBucket {
+public:
+	static const uint HEADER_SZ = 12;
+
+	HashBucket(Db* db, BlockID block_id, bool is_new=false, uint local_depth=0);
+	virtual ~HashBucket();
+	HashBucket(const HashBucket& other) = delete;
+	HashBucket(HashBucket&& temp) = delete;
+	HashBucket& operator=(const HashBucket& other) = delete;
+	HashBucket& operator=(HashBucket&& temp) = delete;
+
+	BlockID get_block_id() const {return block_id;}
+	uint get_local_depth() const {return get_n(0);}
+	void set_local_depth(uint local_depth) {put_n(0, local_depth);}
+	BlockID get_next() const;
+	void set_next(BlockID block_id);
+
+	/**
+	 * @returns  number of entries
+	 */
+	uint size() const {return get_n(2);}
+
+	/**
+	 * Where entry i starts (entries are looked at in order, so walk them with next_entry).
+	 */
+	uint first_entry() const {return HEADER_SZ;}
+	uint next_entry(uint at) const {return at + 6 + get_n(at + 4);}
+	uint32_t hash(uint at) const;
+	TextView key(uint at) const {return TextView(bytes + at + 6, get_n(at + 4));}
+
+	/**
+	 * Would an entry with a key of the given size fit?
+	 */
+	bool has_room(uint key_size) const {return get_n(4) + 6 + key_size <= DbBlock::BLOCK_SZ;}
+
+	/**
+	 * Add an entry at the end.
+	 * @throws  DbBlockNoRoomError if it won't fit (see has_room)
+	 */
+	void add(uint32_t hash, const TextView& key);
+
+	/**
+	 * Take out the entry starting at the given offset.
+	 */
+	void remove(uint at);
+
+	/**
+	 * Take out every entry (leaving the local depth and next page alone).
+	 */
+	void clear();
+
+	/**
+	 * Note that the page has changed, so the buffer pool has to write it back.
+	 */
+	void mark_dirty();
+
+protected:
+	Db* db;
+	BlockID block_id;
+	char* bytes;
+
+	uint get_n(uint offset) const;
+	void put_n(uint offset, uint n);
+};
+
+/**
+ * @class HashIndex - DbIndex implementation with extendible hashing, kept in its own file
+ *
+ * The directory has 2^global_depth entries, each the first page of a bucket; a key goes in the
+ * bucket the low global_depth bits of its hash pick. Several entries can share a bucket, whose local
+ * depth says how many of those bits its keys really have in common. The directory is kept in memory
+ * (and in directory pages in the file, chained from block 1), so a lookup reads just the bucket's
+ * page, plus any overflow pages it has.
+ *
+ * When a bucket fills up, it alone is split in two by the next bit of its keys' hashes; only if its
+ * local depth had caught up with the global depth does the directory double first, which copies
+ * pointers but moves no entries. So the index grows a bucket at a time instead of rehashing
+ * everything at once. A bucket whose keys all hash alike (or one at MAX_DEPTH) gets an overflow
+ * page instead. Buckets emptied by del are not merged.
+ *
+ * Lookups need a value for every column of the key; range is not supported. For unique indices,
+ * insert refuses a record whose key is already there (unless the key has a NULL in it).
+ */
+class HashIndex : public DbIndex {
+public:
+	/**
+	 * Deepest the directory gets (it then has 2^MAX_DEPTH entries)
+	 */
+	static const uint MAX_DEPTH = 20;
+
+	/**
+	 * Biggest key (with the handle) an entry can have
+	 */
+	static const uint MAX_KEY_SZ = 1000;
+
+	HashIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique);
+	virtual ~HashIndex();
+	HashIndex(const HashIndex& other) = delete;
+	HashIndex(HashIndex&& temp) = delete;
+	HashIndex& operator=(const HashIndex& other) = delete;
+	HashIndex& operator=(HashIndex&& temp) = delete;
+
+	virtual void create();
+	virtual void drop();
+	virtual void open();
+	virtual void close();
+	virtual Handles* lookup(ValueDict* key_values) const;
+	virtual void insert(Handle record);
+	virtual void del(Handle record);
+
+	// statistics
+	virtual uint get_global_depth() const {return global_depth;}
+	virtual uint get_bucket_count() const {return bucket_count;}
+
+protected:
+	static const uint32_t STAT_BLOCK = 1;
+	static const uint DIRECTORY_ENTRIES = (DbBlock::BLOCK_SZ - 4) / 4;  // per directory page
+
+	std::string dbfilename;
+	bool closed;
+	mutable Db db;
+	uint global_depth;
+	uint bucket_count;
+	BlockID last;
+	std::vector<BlockID> directory;
+	std::vector<BlockID> directory_pages;
+	KeyCodec codec;
+	ColumnOrdinals key_ordinals;
+
+	virtual void db_open(uint flags=0);
+	virtual void write_stat();
+	virtual void write_directory(uint first, uint last);
+	virtual BlockID allocate();
+	virtual HashBucket* get(BlockID block_id) const;
+	virtual HashBucket* get_new(uint local_depth);
+	virtual std::string entry_key(const Row& key_values, Handle record, bool* any_null=nullptr) const;
+	virtual void add(const std::string& key, bool any_null);
+	virtual Handles* find(const std::string& values, uint32_t hash) const;
+	virtual void split(uint slot);
+	virtual void fill(BlockID block_id, const std::vector<std::pair<uint32_t, std::string>>& entries);
+
+	static uint32_t hash(const char* values, uint size);
+};
+
+/**
+ * Test HashIndex.
+ * @returns  true if all the tests pass
+ */
+bool test_hash_index();
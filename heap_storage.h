@@ -9,6 +9,10 @@
  */
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <set>
 #include "db_cxx.h"
 #include "storage_engine.h"
 
@@ -25,10 +29,29 @@
             Bytes 0x04 - 0x05: size of record 1
             Bytes 0x06 - 0x07: offset to record 1
             etc.
+
+        The top bits of the record count are page flags. Pages flagged LAZY_COMPACTION (all pages
+        created by this version) do not compact on every del() or shrinking put(). Instead they just
+        leave a tombstone, count the dead bytes, and compact once when an add() or put() would
+        otherwise not fit. Tombstoned record ids are handed out again by add(). These pages have a
+        longer block header, so their record headers start at 0x08 instead of 0x04:
+            Bytes 0x04 - 0x05: number of reclaimable (dead) data bytes
+            Bytes 0x06 - 0x07: number of tombstoned record ids available for reuse
+
+        Pages flagged RECORD_FORMAT_V2 (again, all pages created by this version) hold records in
+        HeapTable's second row format (see RowLayout); the page itself doesn't care, it just keeps
+        the tag so that old files stay readable.
  *
  */
 class SlottedPage : public DbBlock {
 public:
+	/**
+	 * Page flags stored in the high bits of the record count
+	 */
+	static const uint16_t LAZY_COMPACTION = 0x8000;
+	static const uint16_t RECORD_FORMAT_V2 = 0x4000;
+	static const uint16_t RECORD_COUNT_MASK = 0x0FFF;
+
 	SlottedPage(Dbt &block, BlockID block_id, bool is_new=false);
 	// Big 5 - we only need the destructor, copy-ctor, move-ctor, and op= are unnecessary
 	// but we delete them explicitly just to make sure we don't use them accidentally
@@ -40,35 +63,178 @@ public:
 
 	virtual RecordID add(const Dbt* data) throw(DbBlockNoRoomError);
 	virtual Dbt* get(RecordID record_id) const;
+	virtual RecordView view(RecordID record_id) const;
 	virtual void put(RecordID record_id, const Dbt &data) throw(DbBlockNoRoomError);
 	virtual void del(RecordID record_id);
 	virtual RecordIDs* ids(void) const;
 
+	/**
+	 * Does this page defer compaction (vs. sliding the data on every del/put)?
+	 */
+	virtual bool is_lazy() const {return (this->flags & LAZY_COMPACTION) != 0;}
+
+	/**
+	 * Which version of the record format the records in this page use (1 or 2).
+	 */
+	virtual uint get_record_format() const {return (this->flags & RECORD_FORMAT_V2) ? 2 : 1;}
+
+	/**
+	 * How many bytes a new record could use, counting its record header.
+	 */
+	virtual uint16_t get_free_space() const;
+
+	/**
+	 * Number of record ids handed out, deleted ones included (though lazy pages take back
+	 * trailing ones, so for them zero means the page is empty).
+	 */
+	virtual uint16_t get_num_records() const {return this->num_records;}
+
 protected:
+	uint16_t flags;
 	uint16_t num_records;
 	uint16_t end_free;
+	uint16_t reclaimable;
+	uint16_t free_slots;
 
 	virtual void get_header(uint16_t &size, uint16_t &loc, RecordID id=0) const;
 	virtual void put_header(RecordID id=0, uint16_t size=0, uint16_t loc=0);
+	virtual uint16_t header_size() const;
 	virtual bool has_room(uint16_t size) const;
+	virtual uint16_t free_space() const;
+	virtual RecordID free_slot() const;
+	virtual void compact(RecordID skip=0);
 	virtual void slide(uint16_t start, uint16_t end);
 	virtual uint16_t get_n(uint16_t offset) const;
 	virtual void put_n(uint16_t offset, uint16_t n);
 	virtual void* address(uint16_t offset) const;
 };
 
+/**
+ * @class BufferedPage - SlottedPage whose memory is a pinned frame of the buffer pool.
+ * Deleting it releases the pin.
+ */
+class BufferedPage : public SlottedPage {
+public:
+	BufferedPage(Dbt &block, BlockID block_id, Db* db, bool is_new=false);
+	virtual ~BufferedPage();
+	BufferedPage(const BufferedPage& other) = delete;
+	BufferedPage(BufferedPage&& temp) = delete;
+	BufferedPage& operator=(const BufferedPage& other) = delete;
+	BufferedPage& operator=(BufferedPage&& temp) = delete;
+
+protected:
+	Db* db;
+};
+
+/**
+ * @class FreeSpaceMap - coarse, persistent record of how much room each block of a HeapFile has
+ *
+ * Each block gets one byte holding its fill bucket: the number of whole BUCKET_SZ chunks of free
+ * space it has. These are kept in a sidecar Berkeley DB RecNo file (one BLOCK_SZ record per
+ * BLOCK_SZ blocks) next to the heap file. In memory we also keep the set of blocks in each
+ * bucket, so finding the first block with enough room only looks at the head of a few sets.
+ * The map is allowed to be stale; callers must still handle DbBlockNoRoomError.
+ */
+class FreeSpaceMap {
+public:
+	static const uint BUCKETS = 16;
+	static const uint BUCKET_SZ = DbBlock::BLOCK_SZ / BUCKETS;
+
+	FreeSpaceMap(std::string name);
+	virtual ~FreeSpaceMap() {}
+	FreeSpaceMap(const FreeSpaceMap& other) = delete;
+	FreeSpaceMap(FreeSpaceMap&& temp) = delete;
+	FreeSpaceMap& operator=(const FreeSpaceMap& other) = delete;
+	FreeSpaceMap& operator=(FreeSpaceMap&& temp) = delete;
+
+	/**
+	 * Open the sidecar file, creating it if necessary.
+	 * @returns  false if the file was just created (so the caller should populate it)
+	 */
+	virtual bool open(void);
+	virtual void close(void);
+	virtual void drop(void);
+
+	/**
+	 * Record how much room a block has now.
+	 * @param block_id    the block
+	 * @param free_bytes  bytes available for new records in the block
+	 */
+	virtual void update(BlockID block_id, uint free_bytes);
+
+	/**
+	 * Find the lowest-numbered block that has at least the given amount of room.
+	 * @param needed  bytes required
+	 * @returns       a block id or 0 if there is no such block
+	 */
+	virtual BlockID find(uint needed) const;
+
+protected:
+	std::string dbfilename;
+	bool closed;
+	Db db;
+	std::vector<uint8_t> buckets;  // buckets[block_id - 1]
+	std::set<BlockID> by_bucket[BUCKETS];  // blocks in each bucket (except 0, they're full)
+	virtual void write(uint32_t page);
+};
+
+class HeapFile;  // forward declare
+
+/**
+ * Decides whether a scan needs to look at a block at all (see ZoneMap).
+ */
+typedef std::function<bool(BlockID block_id)> BlockPredicate;
+
+/**
+ * @class HeapFileCursor - DbBlockCursor over a range of a HeapFile's blocks.
+ * The current block stays pinned in the buffer pool until the cursor moves past it.
+ * With readahead, the cursor keeps the buffer pool's prefetcher reading the next few blocks
+ * while the caller works on the current one. How far ahead it reads adapts to how long the
+ * caller takes per block compared to how long a read takes.
+ * Given a BlockPredicate, the cursor passes over (and doesn't read ahead) the blocks it rejects.
+ */
+class HeapFileCursor : public DbBlockCursor {
+public:
+	HeapFileCursor(HeapFile& file, BlockID start, BlockID end, bool readahead=true,
+			BlockPredicate wanted=nullptr);
+	virtual ~HeapFileCursor();
+	HeapFileCursor(const HeapFileCursor& other) = delete;
+	HeapFileCursor(HeapFileCursor&& temp) = delete;
+	HeapFileCursor& operator=(const HeapFileCursor& other) = delete;
+	HeapFileCursor& operator=(HeapFileCursor&& temp) = delete;
+
+	virtual SlottedPage* next();
+
+protected:
+	HeapFile& file;
+	BlockID next_id;
+	BlockID end;
+	SlottedPage* current;
+	bool readahead;
+	BlockPredicate wanted;
+	std::deque<bool> decided;  // what wanted said about the blocks from decided_from on
+	BlockID decided_from;
+	BlockID requested;    // last block handed to the prefetcher
+	double consume_ns;    // moving average of how long the caller spends per block
+	std::chrono::steady_clock::time_point handed_out;
+
+	virtual bool is_wanted(BlockID block_id);
+	virtual void read_ahead();
+};
+
 /**
  * @class HeapFile - heap file implementation of DbFile
  *
  * Heap file organization. Built on top of Berkeley DB RecNo file. There is one of our
         database blocks for each Berkeley DB record in the RecNo file. In this way we are using Berkeley DB
-        for buffer management and file management.
+        for file management. Blocks are cached in the shared BufferPool: get() pins a block and
+        put() just marks it dirty; dirty blocks are written back when evicted or when the file is closed.
         Uses SlottedPage for storing records within blocks.
  */
 class HeapFile : public DbFile {
 public:
 	HeapFile(std::string name);
-	virtual ~HeapFile() {}
+	virtual ~HeapFile();
 	HeapFile(const HeapFile& other) = delete;
 	HeapFile(HeapFile&& temp) = delete;
 	HeapFile& operator=(const HeapFile& other) = delete;
@@ -82,6 +248,28 @@ public:
 	virtual SlottedPage* get(BlockID block_id);
 	virtual void put(DbBlock* block);
 	virtual BlockIDs* block_ids() const;
+	virtual HeapFileCursor* cursor(BlockID start=1, BlockID end=0);
+
+	/**
+	 * Scan of the blocks from start through end that the given predicate accepts.
+	 * @param start   first block
+	 * @param end     last block (0 for the current last block)
+	 * @param wanted  which blocks to visit
+	 */
+	virtual HeapFileCursor* cursor(BlockID start, BlockID end, BlockPredicate wanted);
+
+	/**
+	 * Append a block that was filled in outside the buffer pool, writing it to the file in one go.
+	 * @param block  page whose id must be one past the current last block
+	 */
+	virtual void put_new(SlottedPage* block);
+
+	/**
+	 * Have the buffer pool start reading the given blocks in the background.
+	 * @param first  first block
+	 * @param last   last block
+	 */
+	virtual void prefetch(BlockID first, BlockID last);
 
 	/**
 	 * Get the id of the current final block in the heap file.
@@ -89,23 +277,490 @@ public:
 	 */
 	virtual uint32_t get_last_block_id() {return last;}
 
+	/**
+	 * Find a block that has room for a new record, according to the free-space map.
+	 * @param size  size of the record to add
+	 * @returns     a block id or 0 if no block is known to have enough room
+	 */
+	virtual BlockID find_room(uint size) const;
+
+	/**
+	 * Tell the free-space map how much room the given block has now.
+	 * (Done automatically by put.) Blocks of records in the old format are recorded as full
+	 * so that new records only go into blocks of the current format.
+	 * @param block  the block
+	 */
+	virtual void update_free_space(SlottedPage* block);
+
 protected:
 	std::string dbfilename;
 	uint32_t last;
 	bool closed;
 	Db db;
+	FreeSpaceMap fsm;
 	virtual void db_open(uint flags=0);
 	virtual uint32_t get_block_count();
 };
 
+/**
+ * @class RowLayout - where each column of a HeapTable's rows lives in the v2 row format
+ *
+ * Version 1 records are just the columns back to back, each TEXT preceded by its 2-byte length,
+ * so getting to a column means walking all the ones before it. Version 2 records have:
+ *      null bitmap:         one bit per column (1 means NULL), (number of columns + 7) / 8 bytes
+ *      fixed-width columns: INT (4 bytes) and BOOLEAN (1 byte), in column order
+ *      offset table:        for each TEXT column, 2-byte offset of the end of its bytes
+ *      TEXT bytes:          in column order
+ * A NULL fixed-width column is all zeros and a NULL TEXT column is empty. Every column is at a
+ * known offset (or between two known offsets), so any one of them can be read directly.
+ */
+class RowLayout {
+public:
+	struct Column {
+		ColumnAttribute::DataType data_type;
+		uint16_t offset;  // fixed-width: the value; TEXT: its end offset in the offset table
+		uint16_t start;   // TEXT only: the previous TEXT column's end offset in the table (0 if first)
+	};
+
+	RowLayout(const ColumnAttributes& column_attributes);
+	virtual ~RowLayout() {}
+
+	// The accessors below are inline, not virtual: RowCodec and RecordFilter call them per column.
+
+	/**
+	 * @returns  number of columns
+	 */
+	uint size() const {return (uint)this->columns.size();}
+
+	const Column& get_column(uint col_num) const {return this->columns[col_num];}
+
+	/**
+	 * @returns  size of the fixed part of a record, which is where the TEXT bytes start
+	 */
+	uint16_t get_text_start() const {return this->text_start;}
+
+	bool is_null(const char* bytes, uint col_num) const {
+		return (bytes[col_num / 8] & (1 << (col_num % 8))) != 0;
+	}
+
+	void set_null(char* bytes, uint col_num) const {
+		bytes[col_num / 8] |= (char)(1 << (col_num % 8));
+	}
+
+	/**
+	 * Locate a TEXT column within a record.
+	 * @param bytes    the record
+	 * @param col_num  which column
+	 * @param size     set to its length
+	 * @returns        its first byte
+	 */
+	const char* get_text(const char* bytes, uint col_num, uint16_t& size) const {
+		const Column& column = this->columns[col_num];
+		uint16_t begin = column.start == 0 ? this->text_start : *(uint16_t*)(bytes + column.start);
+		size = *(uint16_t*)(bytes + column.offset) - begin;
+		return bytes + begin;
+	}
+
+protected:
+	std::vector<Column> columns;
+	uint16_t text_start;
+};
+
+/**
+ * @class BlockSummaries - sidecar file with a fixed-size summary of each block of a HeapFile
+ *
+ * The entries are packed into BLOCK_SZ pages of a Berkeley DB RecNo file next to the heap file.
+ * Pages are written back through the buffer pool, like the heap file's own blocks. All the entries
+ * are also kept in memory, so checking a block's summary never does any I/O. An entry of all
+ * zeros means the block isn't summarized, so anything might be in it.
+ */
+class BlockSummaries {
+public:
+	BlockSummaries(std::string dbfilename);
+	virtual ~BlockSummaries();
+	BlockSummaries(const BlockSummaries& other) = delete;
+	BlockSummaries(BlockSummaries&& temp) = delete;
+	BlockSummaries& operator=(const BlockSummaries& other) = delete;
+	BlockSummaries& operator=(BlockSummaries&& temp) = delete;
+
+	/**
+	 * Open the sidecar file, creating it if necessary.
+	 * @returns  false if the file was just created (so the caller should populate it)
+	 */
+	virtual bool open(void);
+	virtual void close(void);
+	virtual void drop(void);
+
+	/**
+	 * Start the block's summary over: it has no records (yet).
+	 * @param block_id  the block
+	 */
+	virtual void clear(BlockID block_id);
+
+	/**
+	 * Stop summarizing the block: anything might be in it.
+	 * @param block_id  the block
+	 */
+	virtual void forget(BlockID block_id);
+
+	/**
+	 * Is the block summarized (vs. anything might be in it)?
+	 * @param block_id  the block
+	 */
+	virtual bool is_summarized(BlockID block_id) const;
+
+	/**
+	 * Update the block's summary to cover a record added to it.
+	 * @param block_id  the block
+	 * @param record    the record, in the v2 format
+	 */
+	virtual void add(BlockID block_id, const char* record) = 0;
+
+protected:
+	static const uint8_t SUMMARIZED = 1;  // first byte of an entry
+
+	std::string dbfilename;
+	bool closed;
+	Db db;
+	uint entry_size;
+	uint entries_per_page;
+	uint32_t pages;             // in the sidecar file
+	std::vector<char> entries;  // entries[(block_id - 1) * entry_size]
+
+	virtual void set_entry_size(uint entry_size);
+	virtual const char* entry(BlockID block_id) const;
+	virtual char* entry(BlockID block_id);
+	virtual void write(BlockID block_id);
+};
+
+/**
+ * @class ZoneMap - per-block summary of each column's values, for skipping blocks in filtered scans
+ *
+ * For each block and column we keep whether there are any NULLs, whether there are any values
+ * and, if so, the least and greatest: of the values themselves for INT and BOOLEAN, and of their
+ * first PREFIX_SZ bytes (zero-padded) for TEXT. A value outside the range can't be in the block.
+ * Summaries are widened as records are added but not narrowed as they are deleted (except that a
+ * block starts over once it is emptied), so they may be stale but never rule out a block that has
+ * a match.
+ */
+class ZoneMap : public BlockSummaries {
+public:
+	static const uint PREFIX_SZ = 8;
+
+	ZoneMap(std::string name, const RowLayout& layout);
+	virtual ~ZoneMap() {}
+	ZoneMap(const ZoneMap& other) = delete;
+	ZoneMap(ZoneMap&& temp) = delete;
+	ZoneMap& operator=(const ZoneMap& other) = delete;
+	ZoneMap& operator=(ZoneMap&& temp) = delete;
+
+	virtual void add(BlockID block_id, const char* record);
+
+	/**
+	 * Might the block have a row whose INT or BOOLEAN column is between low and high?
+	 * @param block_id  the block
+	 * @param col_num   which column
+	 * @param low       least value wanted
+	 * @param high      greatest value wanted
+	 */
+	virtual bool might_contain(BlockID block_id, uint col_num, int32_t low, int32_t high) const;
+
+	/**
+	 * Might the block have a row whose TEXT column is the given value?
+	 * @param block_id  the block
+	 * @param col_num   which column
+	 * @param text      the value
+	 * @param size      its length
+	 */
+	virtual bool might_contain(BlockID block_id, uint col_num, const char* text, uint size) const;
+
+	/**
+	 * Might the block have a row where the column is NULL?
+	 * @param block_id  the block
+	 * @param col_num   which column
+	 */
+	virtual bool might_contain_null(BlockID block_id, uint col_num) const;
+
+protected:
+	static const uint8_t HAS_VALUE = 1;  // column flags
+	static const uint8_t HAS_NULL = 2;
+
+	const RowLayout& layout;
+	std::vector<uint16_t> offsets;  // where each summarized column is in an entry
+};
+
+/**
+ * @class BloomFilter - per-block Bloom filter of one column's values, for equality predicates
+ *
+ * Unlike a ZoneMap, this can rule out a block for a value that is within the block's range, which
+ * is what an equality lookup on a high-cardinality column (like a name) needs. Deleting a record
+ * can't take its value out of a Bloom filter, so del just marks the block's filter stale; it still
+ * never rules out a block wrongly, and it is rebuilt from the block's records the next time a
+ * record is added to the block. NULLs aren't recorded, so a block might always have a NULL.
+ *
+ * Statistics: probes counts blocks the filter was asked about and passes how many it let through.
+ * Scans whose only predicate is on this column report the blocks that were let through but had no
+ * match (false_positives), so that the false-positive rate can be measured. It can also be
+ * estimated from how full the filters are.
+ */
+class BloomFilter : public BlockSummaries {
+public:
+	static const uint FILTER_BITS = 1024;
+	static const uint HASHES = 3;
+
+	/**
+	 * @param name         the table
+	 * @param column_name  the column
+	 * @param layout       the table's row layout
+	 * @param col_num      which column it is in the layout
+	 */
+	BloomFilter(std::string name, Identifier column_name, const RowLayout& layout, uint col_num);
+	virtual ~BloomFilter() {}
+	BloomFilter(const BloomFilter& other) = delete;
+	BloomFilter(BloomFilter&& temp) = delete;
+	BloomFilter& operator=(const BloomFilter& other) = delete;
+	BloomFilter& operator=(BloomFilter&& temp) = delete;
+
+	virtual void add(BlockID block_id, const char* record);
+
+	/**
+	 * Note that a record was deleted from the block, so its filter may have values it doesn't need.
+	 * @param block_id  the block
+	 */
+	virtual void make_stale(BlockID block_id);
+
+	/**
+	 * Should the block's filter be rebuilt?
+	 * @param block_id  the block
+	 */
+	virtual bool is_stale(BlockID block_id) const;
+
+	/**
+	 * Might the block have a row with the given value in this column?
+	 * @param block_id  the block
+	 * @param value     the value's bytes (an INT's four bytes or a TEXT's characters)
+	 * @param size      number of bytes
+	 */
+	virtual bool might_contain(BlockID block_id, const char* value, uint size) const;
+
+	/**
+	 * Note that a block this filter let through turned out to have no match.
+	 */
+	virtual void false_positive() {this->false_positives++;}
+
+	/**
+	 * @returns  which column this filters
+	 */
+	virtual uint get_col_num() const {return this->col_num;}
+
+	// statistics
+	virtual u_long get_probes() const {return this->probes;}
+	virtual u_long get_passes() const {return this->passes;}
+	virtual u_long get_false_positives() const {return this->false_positives;}
+
+	/**
+	 * Measured false-positive rate: false positives / blocks without the value.
+	 */
+	virtual double false_positive_rate() const;
+
+	/**
+	 * Expected false-positive rate, going by how many bits are set in the summarized blocks' filters.
+	 */
+	virtual double estimated_false_positive_rate() const;
+
+protected:
+	static const uint8_t STALE = 2;  // block flag
+
+	const RowLayout& layout;
+	uint col_num;
+	mutable std::atomic<u_long> probes, passes;
+	std::atomic<u_long> false_positives;
+
+	virtual void hashes(const char* value, uint size, uint32_t bits[HASHES]) const;
+};
+
+typedef std::vector<BloomFilter*> BloomFilters;  // by column number (nullptr for columns without one)
+
+/**
+ * @class RowCodec - v2 row encoder/decoder specialized to one table's schema
+ *
+ * Built once per table from its RowLayout: a flat program of copy ops, one list per column type
+ * (INT, BOOLEAN, TEXT) holding the column positions and record offsets. Encoding and decoding
+ * just run through each list, so there is no per-column switch on the data type (and no copying
+ * of ColumnAttributes) for each row. The row dictionary is read and built in column-name order,
+ * which makes each lookup a step along the map instead of a search.
+ */
+class RowCodec {
+public:
+	RowCodec(const ColumnNames& column_names, const RowLayout& layout);
+	virtual ~RowCodec() {}
+	RowCodec(const RowCodec& other) = delete;
+	RowCodec(RowCodec&& temp) = delete;
+	RowCodec& operator=(const RowCodec& other) = delete;
+	RowCodec& operator=(RowCodec&& temp) = delete;
+
+	/**
+	 * Marshal a row.
+	 * @param row    a value for every column
+	 * @param bytes  where to put the record (at least DbBlock::BLOCK_SZ bytes)
+	 * @returns      size of the record
+	 * @throws       DbRelationError if a column is missing or the record won't fit
+	 */
+	virtual uint encode(const ValueDict* row, char* bytes) const;
+
+	/**
+	 * Unmarshal a v2 record.
+	 * @param bytes  the record
+	 * @returns      the row (freed by caller)
+	 */
+	virtual ValueDict* decode(const char* bytes) const;
+
+	/**
+	 * Unmarshal some of the columns of a v2 record.
+	 * @param bytes     the record
+	 * @param ordinals  which columns
+	 * @param row       where to put them (field i gets column ordinals[i])
+	 * @param borrow    have TEXT fields refer to the record's bytes instead of copying them
+	 */
+	virtual void decode(const char* bytes, const ColumnOrdinals& ordinals, Row* row, bool borrow=false) const;
+
+protected:
+	struct Op {
+		uint col_num;
+		uint16_t offset;  // as in RowLayout::Column
+	};
+	const ColumnNames& column_names;
+	const RowLayout& layout;
+	std::vector<Op> int_ops, boolean_ops, text_ops;
+	std::vector<uint> by_name;  // column numbers in column-name order
+};
+
+/**
+ * @class RecordFilter - a where clause compiled against a HeapTable's schema
+ *
+ * Built once per select: each column in the where clause becomes a check of that column's
+ * type against a constant, sorted into column order. Records are tested directly on their
+ * marshalled bytes (typically still in the page) and the test stops at the first failed check,
+ * so only the rows that match ever get decoded. Version 2 records are checked at each column's
+ * offset; version 1 records have to be walked, but only as far as the last column checked.
+ */
+class RecordFilter {
+public:
+	/**
+	 * @param column_names  the table's columns
+	 * @param layout        where they are in a record
+	 * @param where         column values to match (nullptr matches everything)
+	 * @throws              DbRelationError if where names a column the table doesn't have
+	 */
+	RecordFilter(const ColumnNames& column_names, const RowLayout& layout, const ValueDict* where);
+	virtual ~RecordFilter() {}
+	RecordFilter(const RecordFilter& other) = delete;
+	RecordFilter(RecordFilter&& temp) = delete;
+	RecordFilter& operator=(const RecordFilter& other) = delete;
+	RecordFilter& operator=(RecordFilter&& temp) = delete;
+
+	/**
+	 * Does the record satisfy every check?
+	 * @param record  marshalled row
+	 * @param format  its record format (see SlottedPage::get_record_format)
+	 */
+	virtual bool matches(const RecordView& record, uint format) const;
+
+	/**
+	 * Could any record in the block satisfy every check, according to the zone map and Bloom filters?
+	 * @param zones     the table's zone map
+	 * @param blooms    the table's Bloom filters
+	 * @param block_id  the block
+	 */
+	virtual bool might_match(const ZoneMap& zones, const BloomFilters& blooms, BlockID block_id) const;
+
+	/**
+	 * If there is just one check and its column has a Bloom filter, that filter alone decides which
+	 * blocks get looked at (see BloomFilter::false_positive).
+	 * @param blooms  the table's Bloom filters
+	 * @returns       the filter or nullptr
+	 */
+	virtual BloomFilter* sole_bloom_filter(const BloomFilters& blooms) const;
+
+	/**
+	 * @returns  true if there are no checks (everything matches)
+	 */
+	virtual bool is_empty() const {return this->checks.empty() && !this->never;}
+
+protected:
+	struct Check {
+		uint column;
+		ColumnAttribute::DataType data_type;
+		bool is_null;
+		int32_t n;
+		std::string s;
+	};
+	const RowLayout& layout;
+	std::vector<Check> checks;  // in column order
+	bool never;  // some check compares against a value of the wrong type
+
+	virtual bool matches_v1(const RecordView& record) const;
+};
+
+class HeapTable;  // forward declare
+
+/**
+ * @class HeapTableScan - DbRelationScan over a HeapTable: a block cursor plus a RecordFilter.
+ * The block holding the current row stays pinned until the scan moves off of it, so the
+ * current record can be read in place. A scan can be limited to a range of blocks.
+ */
+class HeapTableScan : public DbRelationScan {
+public:
+	HeapTableScan(HeapTable& table, const ValueDict* where, BlockID start=1, BlockID end=0);
+	virtual ~HeapTableScan();
+	HeapTableScan(const HeapTableScan& other) = delete;
+	HeapTableScan(HeapTableScan&& temp) = delete;
+	HeapTableScan& operator=(const HeapTableScan& other) = delete;
+	HeapTableScan& operator=(HeapTableScan&& temp) = delete;
+
+	virtual bool next(Handle& handle);
+
+	/**
+	 * The record of the row next() last found, still sitting in its block.
+	 */
+	virtual RecordView get_record() const;
+
+	/**
+	 * The record format of get_record() (see SlottedPage::get_record_format).
+	 */
+	virtual uint get_record_format() const;
+
+protected:
+	RecordFilter filter;
+	HeapFileCursor* blocks;
+	SlottedPage* block;     // current block (belongs to blocks)
+	RecordIDs* record_ids;  // ids in the current block
+	uint position;          // how far we are in record_ids
+	BloomFilter* bloom;     // see RecordFilter::sole_bloom_filter
+	bool matched;           // found a match in the current block
+};
+
 /**
  * @class HeapTable - Heap storage engine (implementation of DbRelation)
+ *
+ * select(where) and select_rows(where, ordinals) scan big tables in parallel: the blocks are cut
+ * into morsels of MORSEL_BLOCKS blocks, and each worker thread repeatedly claims the next
+ * unclaimed morsel and scans it, so a worker that falls behind just ends up doing fewer of them.
+ * Each morsel's results are kept separately and put together in morsel order at the end, so the
+ * results are the same (and in the same order) as from a single-threaded scan.
+ *
+ * Scans with a where clause skip blocks that the table's ZoneMap, or the BloomFilter of a column
+ * the where clause checks (see add_bloom_filter), says have no matching rows.
+ *
+ * The indices given to add_index are kept up to date as part of each insert, insert_many, update
+ * and del; a change an index refuses (e.g., a duplicate key in a unique index) is undone in the
+ * table and the other indices, too.
  */
 
 class HeapTable : public DbRelation {
 public:
 	HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes );
-	virtual ~HeapTable() {}
+	virtual ~HeapTable();
 	HeapTable(const HeapTable& other) = delete;
 	HeapTable(HeapTable&& temp) = delete;
 	HeapTable& operator=(const HeapTable& other) = delete;
@@ -119,23 +774,80 @@ public:
 	virtual void close();
 
 	virtual Handle insert(const ValueDict* row);
-	virtual void update(const Handle handle, const ValueDict* new_values);
+	virtual HandleRanges* insert_many(const ValueDicts* rows);
+	virtual Handle update(const Handle handle, const ValueDict* new_values);
 	virtual void del(const Handle handle);
 
-	virtual Handles* select();
+	/**
+	 * Keep a Bloom filter for each block of the values in the given (INT or TEXT) column, so that
+	 * selects on it can skip blocks that don't have the value. The filters are built the next time
+	 * the table is opened (or used, if it is already open).
+	 * @param column_name  the column
+	 * @throws             DbRelationError for an unknown or BOOLEAN column
+	 */
+	virtual void add_bloom_filter(const Identifier& column_name);
+
+	/**
+	 * @param column_name  a column
+	 * @returns            its Bloom filter (e.g., for statistics) or nullptr if it doesn't have one
+	 */
+	virtual const BloomFilter* get_bloom_filter(const Identifier& column_name) const;
+
+	/**
+	 * Most threads to scan a table with (0 means one per core).
+	 * Tables of fewer than two morsels are always scanned by the calling thread alone.
+	 */
+	static uint parallelism;
+
+	/**
+	 * Number of blocks in a morsel, the unit of work claimed by a scan thread.
+	 */
+	static const uint MORSEL_BLOCKS = 16;
+
+	virtual HeapTableScan* open_scan(const ValueDict* where=nullptr);
 	virtual Handles* select(const ValueDict* where);
+	virtual Rows* select_rows(const ValueDict* where, const ColumnOrdinals& ordinals);
+	using DbRelation::select;
 	virtual ValueDict* project(Handle handle);
 	virtual ValueDict* project(Handle handle, const ColumnNames* column_names);
+	virtual Row* project_row(Handle handle, const ColumnOrdinals& ordinals);
+	virtual Rows* project_many(const Handles* handles, const ColumnOrdinals& ordinals);
+	virtual void scan(const ValueDict* where, const ColumnOrdinals& ordinals, RowVisitor visit);
 	using DbRelation::project;
 
+	friend class HeapTableScan;
+
 protected:
 	HeapFile file;
+	RowLayout layout;
+	RowCodec codec;
+	ZoneMap zones;
+	BloomFilters blooms;
 	virtual ValueDict* validate(const ValueDict* row) const;
 	virtual Handle append(const ValueDict* row);
+	virtual void remove(const Handle handle);
+	virtual bool replace(const Handle handle, const char* bytes, uint size, char* old_bytes, uint& old_size);
+	virtual Handle relocate(const Handle handle, const ValueDict* row, const std::vector<DbIndex*>& removed);
+	virtual void index_insert(const Handle handle, const std::vector<DbIndex*>& indices);
 	virtual Dbt* marshal(const ValueDict* row) const;
-	virtual ValueDict* unmarshal(Dbt* data) const;
-	virtual bool selected(Handle handle, const ValueDict* where);
+	virtual uint marshal(const ValueDict* row, char* bytes) const;
+	virtual ValueDict* unmarshal(const RecordView &data, uint format) const;
+	virtual ValueDict* unmarshal_v1(const RecordView &data) const;
+	virtual void decode(const RecordView& data, uint format, const ColumnOrdinals& ordinals, Row* row,
+			bool borrow=false) const;
+	virtual std::vector<BlockSummaries*> summaries();
+	virtual void summarize(const std::vector<BlockSummaries*>& fresh);
+	virtual void summarize(SlottedPage* block, BlockSummaries* summary);
+	virtual void summarize_new(BlockID block_id);
+	virtual void summarize_add(SlottedPage* block, const char* record);
+	virtual void summarize_del(SlottedPage* block);
+
+	typedef std::function<void(uint morsel, BlockID first, BlockID last)> MorselWork;
+	virtual uint morsel_count();
+	virtual uint scan_workers();
+	virtual void for_each_morsel(uint workers, MorselWork work);
 };
 
 bool test_heap_storage();
+void bench_row_codec();
 
@@ -4,6 +4,9 @@
  * @see "Seattle University, CPSC5300, Summer 2018"
  */
 #include "schema_tables.h"
+#include "btree.h"
+#include "hash_index.h"
+#include "art_index.h"
 #include "ParseTreeToString.h"
 
 
@@ -47,6 +50,7 @@ bool is_acceptable_data_type(std::string dt) {
  */
 const Identifier Tables::TABLE_NAME = "_tables";
 Columns* Tables::columns_table = nullptr;
+Indices* Tables::indices_table = nullptr;
 std::map<Identifier,DbRelation*> Tables::table_cache;
 
 // get the column name for _tables column
@@ -69,6 +73,7 @@ ColumnAttributes& Tables::COLUMN_ATTRIBUTES() {
 
 // ctor - we have a fixed table structure of just one column: table_name
 Tables::Tables() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
+    add_bloom_filter("table_name");  // every lookup is by table name
     Tables::table_cache[TABLE_NAME] = this;
     if (Tables::columns_table == nullptr)
         columns_table = new Columns();
@@ -117,30 +122,29 @@ void Tables::get_columns(Identifier table_name, ColumnNames &column_names, Colum
     // SELECT * FROM _columns WHERE table_name = <table_name>
     ValueDict where;
     where["table_name"] = table_name;
-    Handles* handles = Tables::columns_table->select(&where);
+    ColumnNames wanted;
+    wanted.push_back("column_name");
+    wanted.push_back("data_type");
+    ColumnOrdinals ordinals = Tables::columns_table->column_ordinals(&wanted);
 
+    // the row's values are views into _columns' blocks, so only the column names get copied
     ColumnAttribute column_attribute;
-    for (auto const& handle: *handles) {
-        ValueDict* row = Tables::columns_table->project(handle);  // get the row's values: {'column_name': <name>, 'data_type': <type>}
-
-        Identifier column_name = (*row)["column_name"].s;
-        column_names.push_back(column_name);
+    Tables::columns_table->scan(&where, ordinals, [&](Handle handle, const Row& row) {
+        column_names.push_back(row.get_text(0).str());
 
+        TextView data_type_name = row.get_text(1);
         ColumnAttribute::DataType data_type;
-        if ((*row)["data_type"].s == "INT")
+        if (data_type_name == "INT")
             data_type = ColumnAttribute::INT;
-        else if ((*row)["data_type"].s == "TEXT")
+        else if (data_type_name == "TEXT")
             data_type = ColumnAttribute::TEXT;
-        else if ((*row)["data_type"].s == "BOOLEAN")
+        else if (data_type_name == "BOOLEAN")
             data_type = ColumnAttribute::BOOLEAN;
         else
             throw DbRelationError("Unknown data type");
         column_attribute.set_data_type(data_type);
         column_attributes.push_back(column_attribute);
-
-        delete row;
-    }
-    delete handles;
+    });
 }
 
 // Return a table for given table_name.
@@ -155,6 +159,11 @@ DbRelation& Tables::get_table(Identifier table_name) {
     get_columns(table_name, column_names, column_attributes);
     DbRelation* table = new HeapTable(table_name, column_names, column_attributes);
     Tables::table_cache[table_name] = table;
+
+    // get its indices, so it keeps them up to date (this is the only time we look them up)
+    if (Tables::indices_table != nullptr)
+        for (auto const& index_name: Tables::indices_table->get_index_names(table_name))
+            Tables::indices_table->get_index(table_name, index_name);
     return *table;
 }
 
@@ -191,6 +200,7 @@ ColumnAttributes& Columns::COLUMN_ATTRIBUTES() {
 
 // ctor - we have a fixed table structure
 Columns::Columns() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
+    add_bloom_filter("table_name");  // get_columns looks a table's columns up by its name
 }
 
 // Create the file and also, manually add schema columns.
@@ -294,6 +304,15 @@ ColumnAttributes& Indices::COLUMN_ATTRIBUTES() {
 
 // ctor - we have a fixed table structure
 Indices::Indices() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
+    add_bloom_filter("table_name");
+    add_bloom_filter("index_name");
+    if (Tables::indices_table == nullptr)
+        Tables::indices_table = this;
+}
+
+Indices::~Indices() {
+    if (Tables::indices_table == this)
+        Tables::indices_table = nullptr;
 }
 
 // Manually check constraints -- unique on (table, index, column)
@@ -308,7 +327,7 @@ Handle Indices::insert(const ValueDict* row) {
     ValueDict where;
     where["table_name"] = row->at("table_name");
     where["index_name"] = row->at("index_name");
-    if (row->at("seq_in_index").n > 1)
+    if (row->at("seq_in_index").n != 1)
         where["column_name"] = row->at("column_name");  // check for duplicate columns on the same index
     Handles* handles = select(&where);
     bool unique = handles->empty();
@@ -329,6 +348,7 @@ void Indices::del(Handle handle) {
     if (Indices::index_cache.find(cache_key) != Indices::index_cache.end()) {
         DbIndex* index = Indices::index_cache.at(cache_key);
         Indices::index_cache.erase(cache_key);
+        Tables::get_table(table_name).remove_index(index);
         delete index;
     }
     HeapTable::del(handle);
@@ -336,46 +356,51 @@ void Indices::del(Handle handle) {
 
 // Return a list of column names and column attributes for given table.
 void Indices::get_columns(Identifier table_name, Identifier index_name,
-                          ColumnNames &column_names, bool &is_hash, bool &is_unique) {
+                          ColumnNames &column_names, bool &is_hash, bool &is_unique,
+                          ColumnNames *include_columns, Identifier *index_type) {
     // SELECT * FROM _indices WHERE table_name = <table_name> AND index_name = <index_name>
     ValueDict where;
     where["table_name"] = table_name;
     where["index_name"] = index_name;
-    Handles* handles = select(&where);
-
-    Identifier colnames[DbIndex::MAX_COMPOSITE];
-    uint size = 0;
-    for (auto const& handle: *handles) {
-        ValueDict *row = project(handle);
-
-        Identifier column_name = (*row)["column_name"].s;
-        uint which = (uint) (*row)["seq_in_index"].n;
-        colnames[which - 1] = column_name;  // seq_in_index is 1-based
-        if (which > size)
-            size = which;
-        is_unique = (*row)["is_unique"].n != 0;
-        is_hash = (*row)["index_type"].s == "HASH";
-        delete row;
-    }
+    ColumnNames wanted;
+    wanted.push_back("column_name");
+    wanted.push_back("seq_in_index");
+    wanted.push_back("is_unique");
+    wanted.push_back("index_type");
+    ColumnOrdinals ordinals = column_ordinals(&wanted);
+
+    Identifier colnames[DbIndex::MAX_COMPOSITE], includenames[DbIndex::MAX_COMPOSITE];
+    uint size = 0, include_size = 0;
+    int out_of_range = 0;
+    scan(&where, ordinals, [&](Handle handle, const Row& row) {
+        int which = row.get_int(1);
+        if (which == 0 || which > (int) DbIndex::MAX_COMPOSITE || which < -(int) DbIndex::MAX_COMPOSITE) {
+            out_of_range = which;
+            return;
+        }
+        if (which < 0) {
+            includenames[-which - 1] = row.get_text(0).str();  // included columns are -1, -2, ...
+            if ((uint) -which > include_size)
+                include_size = (uint) -which;
+            return;
+        }
+        colnames[which - 1] = row.get_text(0).str();  // seq_in_index is 1-based
+        if ((uint) which > size)
+            size = (uint) which;
+        is_unique = row.get_int(2) != 0;
+        is_hash = row.get_text(3) == "HASH";
+        if (index_type != nullptr)
+            *index_type = row.get_text(3).str();
+    });
+    if (out_of_range != 0)
+        throw DbRelationError("index " + index_name + " has a column numbered " + std::to_string(out_of_range));
     for (uint i = 0; i < size; i++)
         column_names.push_back(colnames[i]);
-    delete handles;
+    if (include_columns != nullptr)
+        for (uint i = 0; i < include_size; i++)
+            include_columns->push_back(includenames[i]);
 }
 
-// FIXME - use this for now until we have BTreeIndex and HashIndex
-class DummyIndex : public DbIndex {
-public:
-    DummyIndex(DbRelation& rel, Identifier idx, ColumnNames key, bool unq) : DbIndex(rel, idx, key, unq) {}
-    void create() {}
-    void drop() {}
-    void open() {}
-    void close() {}
-    Handles* lookup(ValueDict* key_values) const {return nullptr;}
-    void insert(Handle handle) {}
-    void del(Handle handle) {}
-};
-
-
 // Return a table for given table_name.
 DbIndex& Indices::get_index(Identifier table_name, Identifier index_name) {
     // if they are asking about an index we've once constructed, then just return that one
@@ -383,18 +408,28 @@ DbIndex& Indices::get_index(Identifier table_name, Identifier index_name) {
     if (Indices::index_cache.find(cache_key) != Indices::index_cache.end())
         return  *Indices::index_cache[cache_key];
 
-    // otherwise assume it is a DummyIndex (for now)
-    ColumnNames column_names;
-    bool is_hash, is_unique;
-    get_columns(table_name, index_name, column_names, is_hash, is_unique);
+    // getting the table the first time gets all of its indices (maybe this one, too)
     DbRelation& table = Tables::get_table(table_name);
+    if (Indices::index_cache.find(cache_key) != Indices::index_cache.end())
+        return  *Indices::index_cache[cache_key];
+
+    // otherwise construct it
+    ColumnNames column_names, include_columns;
+    bool is_hash, is_unique;
+    Identifier index_type;
+    get_columns(table_name, index_name, column_names, is_hash, is_unique, &include_columns, &index_type);
+    if (column_names.empty())
+        throw DbRelationError("no index " + index_name + " on " + table_name);
     DbIndex* index;
     if (is_hash) {
-        index = new DummyIndex(table, index_name, column_names, is_unique);  // FIXME - change to HashIndex
+        index = new HashIndex(table, index_name, column_names, is_unique);
+    } else if (index_type == "ART") {
+        index = new ARTIndex(table, index_name, column_names, is_unique);  // built from the table when opened
     } else {
-        index = new DummyIndex(table, index_name, column_names, is_unique);  // FIXME - change to BTreeIndex
+        index = new BTreeIndex(table, index_name, column_names, is_unique, include_columns);
     }
     Indices::index_cache[cache_key] = index;
+    table.add_index(index);
     return *index;
 }
 
@@ -403,13 +438,11 @@ IndexNames Indices::get_index_names(Identifier table_name) {
     ValueDict where;
     where["table_name"] = Value(table_name);
     where["seq_in_index"] = Value(1);  // only get the row for the first column if composite index
-    Handles* handles = select(&where);
-    for (auto const& handle: *handles) {
-        ValueDict* row = project(handle);
-        ret.push_back((*row)["index_name"].s);
-        delete row;
-    }
-    delete handles;
+    ColumnNames wanted;
+    wanted.push_back("index_name");
+    scan(&where, column_ordinals(&wanted), [&ret](Handle handle, const Row& row) {
+        ret.push_back(row.get_text(0).str());
+    });
     return ret;
 }
 
@@ -18,6 +18,7 @@ void initialize_schema_tables();
 
 
 class Columns; // forward declare
+class Indices; // forward declare
 
 /**
  * @class Tables - The singleton table that stores the metadata for all other tables.
@@ -52,6 +53,8 @@ public:
 
 	/**
 	 * Get the correctly instantiated DbRelation for a given table.
+	 * The first time, the table's indices are gotten, too (see Indices::get_index), so that
+	 * the table keeps them up to date.
 	 * @param table_name  table to get
 	 * @returns           instantiated DbRelation of the correct type
 	 */
@@ -65,6 +68,10 @@ protected:
 	// keep a reference to the columns table (for get_columns method)
     static Columns* columns_table;
 
+	// and to the indices table (for get_table), set by the first Indices constructed
+    static Indices* indices_table;
+    friend class Indices;
+
 private:
 	// keep a cache of all the tables we've instantiated so far
     static std::map<Identifier,DbRelation*> table_cache;
@@ -97,6 +104,11 @@ protected:
 
 typedef ColumnNames IndexNames;
 
+/**
+ * @class Indices - The singleton table that stores the metadata for all indices.
+ * An index has a row for each of its key columns, numbered by seq_in_index from 1, and one for
+ * each of its included columns (see DbIndex::get_include_columns), numbered -1, -2, ...
+ */
 class Indices : public HeapTable {
 public:
 	/**
@@ -106,7 +118,7 @@ public:
 
 	// ctor/dtor
 	Indices();
-	virtual ~Indices() {}
+	virtual ~Indices();
 
 	/**
 	 * Get the search key for the given index.
@@ -117,12 +129,18 @@ public:
 	 * @param is_hash         returned by reference: set to False if the
 	 *                        requested index is a btree index
 	 * @param is_unique       search key for this index is a key for the relation
+	 * @param include_columns if not nullptr, returned by reference: list of the
+	 *                        included columns in order
+	 * @param index_type      if not nullptr, returned by reference: BTREE, HASH or ART
 	 */ 
 	virtual void get_columns(Identifier table_name, Identifier index_name,
-                             ColumnNames &column_names, bool &is_hash, bool &is_unique);
+                             ColumnNames &column_names, bool &is_hash, bool &is_unique,
+                             ColumnNames *include_columns=nullptr, Identifier *index_type=nullptr);
 
 	/**
 	 * Get the instantiated DbIndex for the given index.
+	 * It is added to its table (see DbRelation::add_index), which keeps it up to date
+	 * until its _indices rows are deleted.
 	 * @param table_name  what table the requested index is on
 	 * @param index_name  name of index (unique by table)
 	 * @returns           DbIndex for requested index
@@ -9,31 +9,47 @@
 #include <iostream>
 #include <string>
 #include <cassert>
+#include <cctype>
 #include "db_cxx.h"
 #include "SQLParser.h"
 #include "ParseTreeToString.h"
 #include "SQLExec.h"
+#include "btree.h"
+#include "hash_index.h"
+#include "art_index.h"
+#include "buffer_pool.h"
 using namespace std;
 using namespace hsql;
 
 /*
- * we allocate and initialize the _DB_ENV global
+ * we allocate and initialize the _DB_ENV and _BUFFER_POOL globals
  */
-void initialize_environment(char *envHome);
+void initialize_environment(char *envHome, uint buffer_frames);
+
+/*
+ * take a CREATE INDEX's INCLUDE (<columns>) clause off, since the parser doesn't know it
+ */
+void take_include_clause(string &query, ColumnNames &include_columns);
 
 
 /**
  * Main entry point of the sql5300 program
- * @args dbenvpath  the path to the BerkeleyDB database environment
+ * @args dbenvpath      the path to the BerkeleyDB database environment
+ * @args buffer_frames  (optional) number of blocks to keep in the buffer pool
  */
 int main(int argc, char *argv[]) {
 
 	// Open/create the db enviroment
-	if (argc != 2) {
-		cerr << "Usage: cpsc5300: dbenvpath" << endl;
+	if (argc != 2 && argc != 3) {
+		cerr << "Usage: cpsc5300: dbenvpath [buffer_frames]" << endl;
 		return 1;
 	}
-	initialize_environment(argv[1]);
+	uint buffer_frames = argc == 3 ? (uint)atoi(argv[2]) : BufferPool::DEFAULT_FRAMES;
+	if (buffer_frames == 0) {
+		cerr << "buffer_frames must be a positive number" << endl;
+		return 1;
+	}
+	initialize_environment(argv[1], buffer_frames);
 
 	// Enter the SQL shell loop
 	while (true) {
@@ -42,14 +58,27 @@ int main(int argc, char *argv[]) {
 		getline(cin, query);
 		if (query.length() == 0)
 			continue;  // blank line -- just skip
-		if (query == "quit")
+		if (query == "quit") {
+			_BUFFER_POOL->flush_all();
 			break;  // only way to get out
+		}
 		if (query == "test") {
 			cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
+			cout << "test_btree: " << (test_btree() ? "ok" : "failed") << endl;
+			cout << "test_hash_index: " << (test_hash_index() ? "ok" : "failed") << endl;
+			cout << "test_art_index: " << (test_art_index() ? "ok" : "failed") << endl;
+			continue;
+		}
+		if (query == "bench") {
+			bench_row_codec();
+			bench_btree();
+			bench_art_index();
 			continue;
 		}
 
 		// parse and execute
+		ColumnNames include_columns;
+		take_include_clause(query, include_columns);
 		SQLParserResult* parse = SQLParser::parseSQLString(query);
 		if (!parse->isValid()) {
 			cout << "invalid SQL: " << query << endl;
@@ -57,14 +86,18 @@ int main(int argc, char *argv[]) {
 		} else {
 			for (uint i = 0; i < parse->size(); ++i) {
 				const SQLStatement *statement = parse->getStatement(i);
+				QueryResult *result = nullptr;
 				try {
-					cout << ParseTreeToString::statement(statement) << endl;
-					QueryResult *result = SQLExec::execute(statement);
+					cout << ParseTreeToString::statement(statement);
+					for (uint j = 0; j < include_columns.size(); j++)
+						cout << (j == 0 ? " INCLUDE (" : ", ") << include_columns[j] << (j + 1 == include_columns.size() ? ")" : "");
+					cout << endl;
+					result = SQLExec::execute(statement, include_columns.empty() ? nullptr : &include_columns);
 					cout << *result << endl;
-					delete result;
 				} catch (SQLExecError& e) {
 					cout << "Error: " << e.what() << endl;
 				}
+				delete result;
 			}
 		}
 		delete parse;
@@ -73,15 +106,16 @@ int main(int argc, char *argv[]) {
 }
 
 DbEnv *_DB_ENV;
-void initialize_environment(char *envHome) {
+void initialize_environment(char *envHome, uint buffer_frames) {
 	cout << "(sql5300: running with database environment at " << envHome
 		 << ")" << endl;
+	_BUFFER_POOL = new BufferPool(buffer_frames);
 
 	DbEnv *env = new DbEnv(0U);
 	env->set_message_stream(&cout);
 	env->set_error_stream(&cerr);
 	try {
-		env->open(envHome, DB_CREATE | DB_INIT_MPOOL, 0);
+		env->open(envHome, DB_CREATE | DB_INIT_MPOOL | DB_THREAD, 0);
 	} catch (DbException &exc) {
 		cerr << "(sql5300: " << exc.what() << ")" << endl;
 		exit(1);
@@ -89,3 +123,34 @@ void initialize_environment(char *envHome) {
 	_DB_ENV = env;
 	initialize_schema_tables();
 }
+
+// CREATE INDEX ... INCLUDE (<column>, ...) [;] -- the clause has to be last
+void take_include_clause(string &query, ColumnNames &include_columns) {
+	string upper = query;
+	for (auto &c: upper)
+		c = (char)toupper(c);
+	size_t create = upper.find_first_not_of(" \t");
+	if (create == string::npos || upper.compare(create, 6, "CREATE") != 0 || upper.find(" INDEX ") == string::npos)
+		return;
+	size_t include = upper.rfind(" INCLUDE");
+	if (include == string::npos)
+		return;
+	size_t open = upper.find_first_not_of(" \t", include + 8);
+	size_t close = upper.find(')', open);
+	if (open == string::npos || upper[open] != '(' || close == string::npos
+			|| upper.find_first_not_of(" \t;", close + 1) != string::npos)
+		return;
+	string columns = query.substr(open + 1, close - open - 1);
+	size_t at = 0;
+	while (at <= columns.size()) {
+		size_t comma = columns.find(',', at);
+		if (comma == string::npos)
+			comma = columns.size();
+		string column = columns.substr(at, comma - at);
+		size_t first = column.find_first_not_of(" \t"), last = column.find_last_not_of(" \t");
+		if (first != string::npos)
+			include_columns.push_back(column.substr(first, last - first + 1));
+		at = comma + 1;
+	}
+	query = query.substr(0, include) + query.substr(close + 1);
+}
@@ -1,8 +1,12 @@
+#include <algorithm>
+#include <ostream>
 #include "storage_engine.h"
 
 bool Value::operator==(const Value &other) const {
     if (this->data_type != other.data_type)
         return false;
+    if (this->is_null || other.is_null)
+        return this->is_null == other.is_null;
     if (this->data_type == ColumnAttribute::INT)
         return this->n == other.n;
     return this->s == other.s;
@@ -12,6 +16,102 @@ bool Value::operator!=(const Value &other) const {
     return !(*this == other);
 }
 
+int TextView::compare(const TextView& other) const {
+    int compared = memcmp(this->data, other.data, this->size < other.size ? this->size : other.size);
+    if (compared != 0)
+        return compared;
+    return this->size < other.size ? -1 : (this->size > other.size ? 1 : 0);
+}
+
+size_t TextView::hash() const {
+    size_t h = 2166136261U;
+    for (uint i = 0; i < this->size; i++)
+        h = (h ^ (unsigned char)this->data[i]) * 16777619U;
+    return h;
+}
+
+std::ostream& operator<<(std::ostream& out, const TextView& text) {
+    return out.write(text.get_data(), text.get_size());
+}
+
+Value Row::get(uint i) const {
+    const Field& field = this->fields[i];
+    ColumnAttribute::DataType data_type = (ColumnAttribute::DataType)field.data_type;
+    if (field.null)
+        return Value::null(data_type);
+    Value value;
+    value.data_type = data_type;
+    if (data_type == ColumnAttribute::TEXT)
+        value.s = get_text(i).str();
+    else
+        value.n = field.n;
+    return value;
+}
+
+void Row::set_null(uint i, ColumnAttribute::DataType data_type) {
+    Field& field = this->fields[i];
+    field.borrowed = nullptr;
+    field.n = 0;
+    field.offset = field.size = 0;
+    field.data_type = (uint8_t)data_type;
+    field.null = true;
+}
+
+void Row::set_int(uint i, int32_t n, ColumnAttribute::DataType data_type) {
+    Field& field = this->fields[i];
+    field.borrowed = nullptr;
+    field.n = n;
+    field.offset = field.size = 0;
+    field.data_type = (uint8_t)data_type;
+    field.null = false;
+}
+
+void Row::set_text(uint i, const char* bytes, uint size) {
+    Field& field = this->fields[i];
+    field.borrowed = nullptr;
+    field.n = 0;
+    field.offset = (uint32_t)this->text.size();
+    field.size = size;
+    field.data_type = (uint8_t)ColumnAttribute::TEXT;
+    field.null = false;
+    this->text.append(bytes, size);
+}
+
+void Row::borrow_text(uint i, const char* bytes, uint size) {
+    Field& field = this->fields[i];
+    field.borrowed = bytes;
+    field.n = 0;
+    field.offset = 0;
+    field.size = size;
+    field.data_type = (uint8_t)ColumnAttribute::TEXT;
+    field.null = false;
+}
+
+void Row::own() {
+    for (auto& field: this->fields)
+        if (field.borrowed != nullptr) {
+            field.offset = (uint32_t)this->text.size();
+            this->text.append(field.borrowed, field.size);
+            field.borrowed = nullptr;
+        }
+}
+
+void Row::set(uint i, const Value& value) {
+    if (value.is_null)
+        set_null(i, value.data_type);
+    else if (value.data_type == ColumnAttribute::TEXT)
+        set_text(i, value.s.data(), (uint)value.s.length());
+    else
+        set_int(i, value.n, value.data_type);
+}
+
+ValueDict* Row::to_dict(const ColumnNames& column_names) const {
+    ValueDict* row = new ValueDict();
+    for (uint i = 0; i < size(); i++)
+        (*row)[column_names[i]] = get(i);
+    return row;
+}
+
 // Just pulls out the column names from a ValueDict and passes that to the usual form of project().
 ValueDict* DbRelation::project(Handle handle, const ValueDict* where) {
     ColumnNames t;
@@ -20,3 +120,258 @@ ValueDict* DbRelation::project(Handle handle, const ValueDict* where) {
     return this->project(handle, &t);
 }
 
+
+// Adds a handle to the end of a list of handle ranges, extending the last range if it can.
+void DbRelation::add_handle(HandleRanges* ranges, Handle handle) {
+    if (!ranges->empty()) {
+        HandleRange& last = ranges->back();
+        if (last.block_id == handle.first && last.last + 1U == handle.second) {
+            last.last = handle.second;
+            return;
+        }
+    }
+    ranges->push_back(HandleRange(handle.first, handle.second, handle.second));
+}
+
+// Row-at-a-time bulk insert for relations that don't have anything better.
+HandleRanges* DbRelation::insert_many(const ValueDicts* rows) {
+    HandleRanges* ranges = new HandleRanges();
+    for (auto const& row: *rows)
+        add_handle(ranges, this->insert(row));
+    return ranges;
+}
+
+void DbRelation::add_index(DbIndex* index) {
+    if (std::find(this->indices.begin(), this->indices.end(), index) == this->indices.end())
+        this->indices.push_back(index);
+}
+
+void DbRelation::remove_index(DbIndex* index) {
+    this->indices.erase(std::remove(this->indices.begin(), this->indices.end(), index), this->indices.end());
+}
+
+// Linear search is fine here; it happens once per query, not once per row.
+ColumnOrdinals DbRelation::column_ordinals(const ColumnNames* column_names) const {
+    ColumnOrdinals ordinals;
+    if (column_names == nullptr || column_names->empty()) {
+        for (uint i = 0; i < this->column_names.size(); i++)
+            ordinals.push_back(i);
+        return ordinals;
+    }
+    for (auto const& column_name: *column_names) {
+        uint i = 0;
+        while (i < this->column_names.size() && this->column_names[i] != column_name)
+            i++;
+        if (i == this->column_names.size())
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+        ordinals.push_back(i);
+    }
+    return ordinals;
+}
+
+Row* DbRelation::project_row(Handle handle, const ColumnOrdinals& ordinals) {
+    ValueDict* values = this->project(handle);
+    Row* row = new Row((uint)ordinals.size());
+    for (uint i = 0; i < ordinals.size(); i++)
+        row->set(i, values->at(this->column_names[ordinals[i]]));
+    delete values;
+    return row;
+}
+
+Rows* DbRelation::project_many(const Handles* handles, const ColumnOrdinals& ordinals) {
+    Rows* rows = new Rows();
+    try {
+        for (auto const& handle: *handles)
+            rows->push_back(this->project_row(handle, ordinals));
+    } catch (...) {
+        for (auto row: *rows)
+            delete row;
+        delete rows;
+        throw;
+    }
+    return rows;
+}
+
+Rows* DbRelation::select_rows(const ValueDict* where, const ColumnOrdinals& ordinals) {
+    Rows* rows = new Rows();
+    try {
+        this->scan(where, ordinals, [rows](Handle handle, const Row& row) {
+            Row* copy = new Row(row);
+            copy->own();
+            rows->push_back(copy);
+        });
+    } catch (...) {
+        for (auto row: *rows)
+            delete row;
+        delete rows;
+        throw;
+    }
+    return rows;
+}
+
+Handles* DbRelation::select() {
+    return this->select(nullptr);
+}
+
+Handles* DbRelation::select(const ValueDict* where) {
+    Handles* handles = new Handles();
+    DbRelationScan* scan = this->open_scan(where);
+    Handle handle;
+    while (scan->next(handle))
+        handles->push_back(handle);
+    delete scan;
+    return handles;
+}
+
+void DbRelation::scan(const ValueDict* where, const ColumnOrdinals& ordinals, RowVisitor visit) {
+    DbRelationScan* scan = this->open_scan(where);
+    Handle handle;
+    try {
+        while (scan->next(handle)) {
+            Row* row = this->project_row(handle, ordinals);
+            try {
+                visit(handle, *row);
+            } catch (...) {
+                delete row;
+                throw;
+            }
+            delete row;
+        }
+    } catch (...) {
+        delete scan;
+        throw;
+    }
+    delete scan;
+}
+
+KeyCodec::KeyCodec(const ColumnAttributes& key_attributes) : data_types() {
+    for (auto ca: key_attributes)
+        this->data_types.push_back(ca.get_data_type());
+}
+
+uint KeyCodec::encode(const ColumnNames& key_columns, const ValueDict* key_values, std::string& key) const {
+    uint n = 0;
+    for (; n < key_columns.size(); n++) {
+        ValueDict::const_iterator value = key_values->find(key_columns[n]);
+        if (value == key_values->end())
+            break;
+        if (!accepts(n, value->second))
+            throw DbRelationError("value for " + key_columns[n] + " is not of its column's type");
+        encode(this->data_types[n], value->second, key);
+    }
+    return n;
+}
+
+bool KeyCodec::encode(const Row& row, std::string& key, uint first) const {
+    bool any_null = false;
+    for (uint i = 0; i < this->data_types.size(); i++) {
+        if (row.is_null(first + i)) {
+            key.push_back('\0');
+            any_null = true;
+        } else {
+            key.push_back('\1');
+            if (this->data_types[i] == ColumnAttribute::TEXT)
+                encode_text(row.get_text(first + i), key);
+            else
+                encode_int(row.get_int(first + i), key);
+        }
+    }
+    return any_null;
+}
+
+void KeyCodec::encode(ColumnAttribute::DataType data_type, const Value& value, std::string& key) const {
+    if (value.is_null) {
+        key.push_back('\0');
+        return;
+    }
+    key.push_back('\1');
+    if (data_type == ColumnAttribute::TEXT)
+        encode_text(value.s, key);
+    else
+        encode_int(value.n, key);
+}
+
+void KeyCodec::encode_int(int32_t n, std::string& key) {
+    uint32_t bits = (uint32_t)n ^ 0x80000000U;
+    for (int shift = 24; shift >= 0; shift -= 8)
+        key.push_back((char)(bits >> shift));
+}
+
+void KeyCodec::encode_text(const TextView& text, std::string& key) {
+    for (uint i = 0; i < text.get_size(); i++) {
+        char c = text.get_data()[i];
+        key.push_back(c);
+        if (c == '\0')
+            key.push_back('\xff');
+    }
+    key.push_back('\0');
+    key.push_back('\0');
+}
+
+void KeyCodec::decode(const char* key, uint size, Row* row, uint first) const {
+    uint at = 0;
+    for (uint i = 0; i < this->data_types.size() && at < size; i++) {
+        ColumnAttribute::DataType data_type = this->data_types[i];
+        if (key[at++] == '\0') {
+            row->set_null(first + i, data_type);
+        } else if (data_type == ColumnAttribute::TEXT) {
+            std::string s;
+            while (at + 1 < size && !(key[at] == '\0' && key[at + 1] == '\0')) {
+                s.push_back(key[at]);
+                at += key[at] == '\0' ? 2 : 1;
+            }
+            at += 2;
+            row->set_text(first + i, s.data(), (uint)s.size());
+        } else {
+            const unsigned char* bytes = (const unsigned char*)key + at;
+            uint32_t n = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+            row->set_int(first + i, (int32_t)(n ^ 0x80000000U), data_type);
+            at += 4;
+        }
+    }
+}
+
+bool KeyCodec::has_null(const char* key, uint size) const {
+    uint at = 0;
+    for (uint i = 0; i < this->data_types.size() && at < size; i++) {
+        if (key[at++] == '\0')
+            return true;
+        if (this->data_types[i] != ColumnAttribute::TEXT) {
+            at += 4;
+            continue;
+        }
+        while (at + 1 < size && !(key[at] == '\0' && key[at + 1] == '\0'))
+            at += key[at] == '\0' ? 2 : 1;
+        at += 2;
+    }
+    return false;
+}
+
+// The handle goes on big-endian, so entries with the same key values are in handle order.
+void KeyCodec::append_handle(std::string& key, Handle handle) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+        key.push_back((char)(handle.first >> shift));
+    key.push_back((char)(handle.second >> 8));
+    key.push_back((char)handle.second);
+}
+
+Handle KeyCodec::get_handle(const char* key, uint size) {
+    const unsigned char* bytes = (const unsigned char*)key + size - HANDLE_SZ;
+    BlockID block_id = ((BlockID)bytes[0] << 24) | ((BlockID)bytes[1] << 16) | ((BlockID)bytes[2] << 8) | bytes[3];
+    return Handle(block_id, (RecordID)((bytes[4] << 8) | bytes[5]));
+}
+
+// One at a time; if one fails, the ones already in are taken back out.
+void DbIndex::insert_many(const Handles* records) {
+    uint done = 0;
+    try {
+        for (auto const& record: *records) {
+            this->insert(record);
+            done++;
+        }
+    } catch (...) {
+        for (uint i = 0; i < done; i++)
+            this->del((*records)[i]);
+        throw;
+    }
+}
@@ -9,8 +9,12 @@
  */
 #pragma once
 
+#include <cstring>
 #include <exception>
+#include <functional>
+#include <iosfwd>
 #include <map>
+#include <string>
 #include <utility>
 #include <vector>
 #include "db_cxx.h"
@@ -28,6 +32,37 @@ typedef uint32_t BlockID;
 typedef std::vector<RecordID> RecordIDs;
 typedef std::length_error DbBlockNoRoomError;
 
+/**
+ * @class RecordView - non-owning view of the bytes of one record within a DbBlock
+ *
+ * Points directly into the block's memory, so it is only valid as long as the
+ * block it came from is alive and has not been modified.
+ */
+class RecordView {
+public:
+	RecordView() : data(nullptr), size(0) {}
+	RecordView(const void* data, uint16_t size) : data((const char*)data), size(size) {}
+
+	/**
+	 * @returns  pointer to the first byte of the record (nullptr if deleted)
+	 */
+	const char* get_data() const {return data;}
+
+	/**
+	 * @returns  number of bytes in the record
+	 */
+	uint16_t get_size() const {return size;}
+
+	/**
+	 * @returns  true if there is no record here (e.g., it has been deleted)
+	 */
+	bool is_null() const {return data == nullptr;}
+
+protected:
+	const char* data;
+	uint16_t size;
+};
+
 /**
  * @class DbBlock - abstract base class for blocks in our database files 
  * (DbBlock's belong to DbFile's.)
@@ -35,6 +70,7 @@ typedef std::length_error DbBlockNoRoomError;
  * Methods for putting/getting records in blocks:
  * 	add(data)
  * 	get(record_id)
+ * 	view(record_id)
  * 	put(record_id, data)
  * 	del(record_id)
  * 	ids()
@@ -71,6 +107,14 @@ public:
 	 */
 	virtual Dbt* get(RecordID record_id) const = 0;
 
+	/**
+	 * Look at a record in this block without copying it.
+	 * @param record_id  which record to look at
+	 * @returns          view of the record's bytes within this block (null view
+	 *                   if the record has been deleted)
+	 */
+	virtual RecordView view(RecordID record_id) const = 0;
+
 	/**
 	 * Change the data stored for a record in this block.
 	 * @param record_id  which record to update
@@ -116,7 +160,24 @@ protected:
 };
 
 // convenience type alias
-typedef std::vector<BlockID> BlockIDs;  // FIXME: will need to turn this into an iterator at some point
+typedef std::vector<BlockID> BlockIDs;  // for scans, use a DbBlockCursor instead
+
+/**
+ * @class DbBlockCursor - abstract base class for a forward scan over the blocks of a DbFile
+ *
+ * Hands out one block at a time so a scan starts right away and only ever holds one block.
+ */
+class DbBlockCursor {
+public:
+	virtual ~DbBlockCursor() {}
+
+	/**
+	 * Advance to the next block.
+	 * @returns  the next block or nullptr at the end; it belongs to the cursor and is only
+	 *           valid until the next call to next() or until the cursor is deleted
+	 */
+	virtual DbBlock* next() = 0;
+};
 
 /**
  * @class DbFile - abstract base class which represents a disk-based collection of DbBlocks
@@ -128,6 +189,7 @@ typedef std::vector<BlockID> BlockIDs;  // FIXME: will need to turn this into an
  *	get(block_id)
  *	put(block)
  *	block_ids()
+ *	cursor(start, end)
  */
 class DbFile {
 public:
@@ -176,11 +238,19 @@ public:
 
 	/**
 	 * Get a list of all the valid BlockID's in the file
-	 * FIXME - not a good long-term approach, but we'll do this until we put in iterators
+	 * Not a good approach for scans (see cursor), but handy for small files.
 	 * @returns  a pointer to vector of BlockIDs (freed by caller)
 	 */ 
 	virtual BlockIDs* block_ids() const = 0;
 
+	/**
+	 * Start a scan of the blocks in the file, in BlockID order.
+	 * @param start  first block to visit
+	 * @param end    last block to visit (0 means the file's last block when the scan starts)
+	 * @returns      a cursor over the blocks (freed by caller)
+	 */
+	virtual DbBlockCursor* cursor(BlockID start=1, BlockID end=0) = 0;
+
 protected:
 	std::string name;  // filename (or part of it)
 };
@@ -209,17 +279,28 @@ protected:
 
 
 /**
- * @class Value - holds value for a field
+ * @class Value - holds value for a field (or a NULL of the field's type, see null())
  */
 class Value {
 public:
 	ColumnAttribute::DataType data_type;
 	int32_t n;
 	std::string s;
+	bool is_null;
 
-	Value() : n(0) {data_type = ColumnAttribute::INT;}
-	Value(int32_t n) : n(n) {data_type = ColumnAttribute::INT;}
-	Value(std::string s) : s(s) {data_type = ColumnAttribute::TEXT; }
+	Value() : n(0), is_null(false) {data_type = ColumnAttribute::INT;}
+	Value(int32_t n) : n(n), is_null(false) {data_type = ColumnAttribute::INT;}
+	Value(std::string s) : n(0), s(s), is_null(false) {data_type = ColumnAttribute::TEXT; }
+
+	/**
+	 * A NULL of the given type. NULLs only compare equal to NULLs (of the same type).
+	 */
+	static Value null(ColumnAttribute::DataType data_type) {
+		Value value;
+		value.data_type = data_type;
+		value.is_null = true;
+		return value;
+	}
 
 	bool operator==(const Value &other) const;
 	bool operator!=(const Value &other) const;
@@ -230,10 +311,185 @@ typedef std::string Identifier;
 typedef std::vector<Identifier> ColumnNames;
 typedef std::vector<ColumnAttribute> ColumnAttributes;
 typedef std::pair<BlockID, RecordID> Handle;
-typedef std::vector<Handle> Handles;  // FIXME: will need to turn this into an iterator at some point
+typedef std::vector<Handle> Handles;  // for big results, use a DbRelationScan instead
 typedef std::map<Identifier, Value> ValueDict;
 typedef std::vector<ValueDict*> ValueDicts;
+typedef std::vector<uint> ColumnOrdinals;  // positions of columns in their relation
+
+/**
+ * @class TextView - read-only reference to TEXT bytes that live somewhere else
+ *
+ * Typically the bytes are a record sitting in a block pinned in the buffer pool, so a view is
+ * only good for as long as the block stays pinned; use str() to keep a copy. Views compare,
+ * hash and print without copying anything. A std::string or a C string converts implicitly
+ * (as a view of its characters), so a view can be compared directly to either.
+ */
+class TextView {
+public:
+	TextView() : data(nullptr), size(0) {}
+	TextView(const char* data, uint size) : data(data), size(size) {}
+	TextView(const char* s) : data(s), size((uint)strlen(s)) {}
+	TextView(const std::string& s) : data(s.data()), size((uint)s.length()) {}
+
+	const char* get_data() const {return data;}
+	uint get_size() const {return size;}
+
+	/**
+	 * @returns  a copy of the bytes that doesn't depend on where they are
+	 */
+	std::string str() const {return std::string(data, size);}
+
+	/**
+	 * Byte-wise comparison, like std::string::compare.
+	 */
+	int compare(const TextView& other) const;
+	bool operator==(const TextView& other) const {return size == other.size && compare(other) == 0;}
+	bool operator!=(const TextView& other) const {return !(*this == other);}
+	bool operator<(const TextView& other) const {return compare(other) < 0;}
+
+	/**
+	 * FNV-1a hash of the bytes.
+	 */
+	size_t hash() const;
+
+protected:
+	const char* data;
+	uint size;
+};
+
+std::ostream& operator<<(std::ostream& out, const TextView& text);
+
+namespace std {
+template<> struct hash<TextView> {
+	size_t operator()(const TextView& text) const {return text.hash();}
+};
+}
+
+/**
+ * @class Row - a row's values by position, for moving lots of rows around
+ *
+ * A ValueDict is a tree with a node, a string key and a full Value (string and all) per column.
+ * A Row is one array of small tagged fields plus one buffer holding all of the row's TEXT bytes,
+ * so it is two allocations no matter how wide it is. TEXT fields can also be borrowed: they
+ * just point at bytes that live elsewhere, like in a pinned block during a scan (see
+ * DbRelation::scan), so that reading a row copies no strings at all. Rows don't know their column names: the
+ * names are resolved to ordinals once per query (see DbRelation::column_ordinals) and whoever
+ * asked for the row knows what field i is.
+ */
+class Row {
+public:
+	Row() : fields(), text() {}
+	explicit Row(uint size) : fields(size), text() {}
+
+	/**
+	 * @returns  number of fields
+	 */
+	uint size() const {return (uint)fields.size();}
+
+	ColumnAttribute::DataType get_data_type(uint i) const {return (ColumnAttribute::DataType)fields[i].data_type;}
+	bool is_null(uint i) const {return fields[i].null;}
+
+	/**
+	 * @returns  the value of an INT or BOOLEAN field
+	 */
+	int32_t get_int(uint i) const {return fields[i].n;}
+
+	/**
+	 * @returns  the value of a TEXT field (only good while the row is, and if the field was
+	 *           borrowed, while the bytes it was borrowed from are)
+	 */
+	TextView get_text(uint i) const {
+		const Field& field = fields[i];
+		return TextView(field.borrowed != nullptr ? field.borrowed : text.data() + field.offset, field.size);
+	}
+
+	/**
+	 * @returns  the field as a Value
+	 */
+	Value get(uint i) const;
+
+	void set_null(uint i, ColumnAttribute::DataType data_type);
+	void set_int(uint i, int32_t n, ColumnAttribute::DataType data_type=ColumnAttribute::INT);
+	void set_text(uint i, const char* bytes, uint size);
+	void set(uint i, const Value& value);
+
+	/**
+	 * Make a TEXT field that refers to the given bytes instead of copying them.
+	 * They must stay put for as long as the field is used (or until own() is called).
+	 */
+	void borrow_text(uint i, const char* bytes, uint size);
+
+	/**
+	 * Copy any borrowed TEXT into the row so that it no longer depends on where it came from.
+	 */
+	void own();
+
+	/**
+	 * Drop the row's TEXT bytes, keeping the space, so the row can be refilled field by field.
+	 */
+	void clear() {text.clear();}
+
+	/**
+	 * Compatibility adapter for code that wants dictionaries.
+	 * @param column_names  name of each field, in order
+	 * @returns             the row as a dictionary (freed by caller)
+	 */
+	ValueDict* to_dict(const ColumnNames& column_names) const;
+
+protected:
+	struct Field {
+		const char* borrowed;  // TEXT: its bytes if they aren't ours
+		int32_t n;
+		uint32_t offset;  // TEXT: where its bytes are in text (if not borrowed)
+		uint32_t size;    // TEXT: how many
+		uint8_t data_type;
+		bool null;
+	};
+	std::vector<Field> fields;
+	std::string text;
+};
+typedef std::vector<Row*> Rows;
 
+/**
+ * Callback for DbRelation::scan: gets each qualifying row's handle and (borrowed) values.
+ */
+typedef std::function<void(Handle handle, const Row& row)> RowVisitor;
+
+/**
+ * @class HandleRange - consecutive records first..last within one block
+ * A compact way to hand back the many handles made by a bulk insert.
+ */
+class HandleRange {
+public:
+	BlockID block_id;
+	RecordID first;
+	RecordID last;
+
+	HandleRange(BlockID block_id, RecordID first, RecordID last) : block_id(block_id), first(first), last(last) {}
+
+	/**
+	 * @returns  number of handles in the range
+	 */
+	uint size() const {return last - first + 1U;}
+};
+typedef std::vector<HandleRange> HandleRanges;
+
+
+/**
+ * @class DbRelationScan - pull-based scan over the rows of a relation that satisfy a where clause
+ * (see DbRelation::open_scan)
+ */
+class DbRelationScan {
+public:
+	virtual ~DbRelationScan() {}
+
+	/**
+	 * Advance to the next qualifying row.
+	 * @param handle  set to the row's handle
+	 * @returns       false (leaving handle alone) once there are no more rows
+	 */
+	virtual bool next(Handle& handle) = 0;
+};
 
 /**
  * @class DbRelationError - generic exception class for DbRelation
@@ -256,18 +512,28 @@ public:
  * 	close()
  * 	
  *	insert(row)
+ *	insert_many(rows)
  *	update(handle, new_values)
  *	del(handle)
+ *	open_scan(where)
  *	select()
  *	select(where)
+ *	select_rows(where, ordinals)
  *	project(handle)
  *	project(handle, column_names)
+ *	project_row(handle, ordinals)
+ *	project_many(handles, ordinals)
+ *
+ *	add_index(index)
+ *	remove_index(index)
  */
+class DbIndex;  // forward declare
+
 class DbRelation {
 public:
 	// ctor/dtor
 	DbRelation(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes ) :
-		table_name(table_name), column_names(column_names), column_attributes(column_attributes) {}
+		table_name(table_name), column_names(column_names), column_attributes(column_attributes), indices() {}
 	virtual ~DbRelation() {}
 
 	/**
@@ -306,14 +572,24 @@ public:
 	 */
 	virtual Handle insert(const ValueDict* row) = 0;
 
+	/**
+	 * Bulk load: execute INSERT INTO <table_name> ... for each of the given rows.
+	 * The default just does one insert at a time.
+	 * @param rows  dictionaries keyed by column names
+	 * @returns     handles to the new rows, in order, as runs of consecutive records
+	 *              (freed by caller)
+	 */
+	virtual HandleRanges* insert_many(const ValueDicts* rows);
+
 	/**
 	 * Conceptually, execute: UPDATE INTO <table_name> SET <new_valus> WHERE <handle>
 	 * where handle is sufficient to identify one specific record (e.g., returned
 	 * from an insert or select).
 	 * @param handle      the row to update
 	 * @param new_values  a dictionary keyd by column names for changing columns
+	 * @returns           the row's handle, which is a new one if the row had to move
 	 */
-	virtual void update(const Handle handle, const ValueDict* new_values) = 0;
+	virtual Handle update(const Handle handle, const ValueDict* new_values) = 0;
 
 	/**
 	 * Conceptually, execute: DELETE FROM <table_name> WHERE <handle>
@@ -323,18 +599,29 @@ public:
 	 */ 
 	virtual void del(const Handle handle) = 0;
 
+	/**
+	 * Start a scan for: SELECT <handle> FROM <table_name> WHERE <where>
+	 * Qualifying rows are found as the scan is advanced, so the first one is available right
+	 * away and nothing is held but the scan's position.
+	 * @param where  where-clause predicates (nullptr for all rows); the scan keeps its own copy
+	 * @returns      the scan (freed by caller)
+	 */
+	virtual DbRelationScan* open_scan(const ValueDict* where=nullptr) = 0;
+
 	/**
 	 * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE 1
+	 * Runs open_scan to completion.
 	 * @returns  a pointer to a list of handles for qualifying rows (caller frees)
 	 */
-	virtual Handles* select() = 0;
+	virtual Handles* select();
 
 	/**
 	 * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
+	 * Runs open_scan to completion.
 	 * @param where  where-clause predicates
 	 * @returns      a pointer to a list of handles for qualifying rows (freed by caller)
 	 */
-	virtual Handles* select(const ValueDict* where) = 0;
+	virtual Handles* select(const ValueDict* where);
 
 	/**
 	 * Return a sequence of all values for handle (SELECT *).
@@ -361,6 +648,62 @@ public:
 	 */
 	virtual ValueDict* project(Handle handle, const ValueDict* column_names);
 
+	/**
+	 * Look up where the given columns are in this relation, so that rows can be projected
+	 * by position instead of by name.
+	 * @param column_names  columns (an empty list means all of them)
+	 * @returns             the position of each column, in the same order
+	 * @throws              DbRelationError if there is no such column
+	 */
+	virtual ColumnOrdinals column_ordinals(const ColumnNames* column_names) const;
+
+	/**
+	 * Return the values for handle given by column ordinals as a Row (SELECT <columns>).
+	 * The default converts from project's dictionary.
+	 * @param handle    row to get values from
+	 * @param ordinals  which columns (see column_ordinals), field i of the row is ordinals[i]
+	 * @returns         the row (freed by caller)
+	 */
+	virtual Row* project_row(Handle handle, const ColumnOrdinals& ordinals);
+
+	/**
+	 * Return the values for each of the given handles as Rows (SELECT <columns> for a batch of rows,
+	 * e.g., the handles from an index lookup).
+	 * The default just calls project_row for each one.
+	 * @param handles   rows to get values from, in any order
+	 * @param ordinals  which columns (see column_ordinals), field i of each row is ordinals[i]
+	 * @returns         a row for each handle, in the same order as handles (freed by caller)
+	 */
+	virtual Rows* project_many(const Handles* handles, const ColumnOrdinals& ordinals);
+
+	/**
+	 * Visit each row satisfying the where clause: SELECT <columns> FROM <table_name> WHERE <where>.
+	 * The row passed to visit may borrow its TEXT from the table's blocks, so it is only good
+	 * during the call; copy what you need to keep (or copy the row and call Row::own on it).
+	 * The default projects a row for each handle from open_scan.
+	 * @param where     where-clause predicates (nullptr for all rows)
+	 * @param ordinals  which columns (see column_ordinals), field i of the row is ordinals[i]
+	 * @param visit     called for each row, in handle order
+	 */
+	virtual void scan(const ValueDict* where, const ColumnOrdinals& ordinals, RowVisitor visit);
+
+	/**
+	 * Conceptually, execute: SELECT <columns> FROM <table_name> WHERE <where>, keeping the rows.
+	 * The default copies each row from scan.
+	 * @param where     where-clause predicates (nullptr for all rows)
+	 * @param ordinals  which columns (see column_ordinals), field i of each row is ordinals[i]
+	 * @returns         the qualifying rows, in handle order (freed by caller)
+	 */
+	virtual Rows* select_rows(const ValueDict* where, const ColumnOrdinals& ordinals);
+
+	/**
+	 * Accessor for table_name.
+	 * @returns table_name   name of this relation
+	 */
+	virtual const Identifier& get_table_name() const {
+		return table_name;
+	}
+
 	/**
 	 * Accessor for column_names.
 	 * @returns column_names   list of column names for this relation, in order
@@ -377,10 +720,123 @@ public:
 		return column_attributes;
 	}
 
+	/**
+	 * Keep the given index up to date from now on: insert, insert_many, update and del change its
+	 * entries along with the rows (if the relation supports it, as HeapTable does). The relation
+	 * doesn't own the index; it has to be removed before it is deleted.
+	 * @param index  an index on this relation
+	 */
+	virtual void add_index(DbIndex* index);
+
+	/**
+	 * Stop keeping the given index up to date (see add_index).
+	 * @param index  an index previously added
+	 */
+	virtual void remove_index(DbIndex* index);
+
+	/**
+	 * Accessor for indices.
+	 * @returns  the indices kept up to date with this relation (see add_index)
+	 */
+	virtual const std::vector<DbIndex*>& get_indices() const {
+		return indices;
+	}
+
 protected:
 	Identifier table_name;
 	ColumnNames column_names;
 	ColumnAttributes column_attributes;
+	std::vector<DbIndex*> indices;
+
+	static void add_handle(HandleRanges* ranges, Handle handle);
+};
+
+/**
+ * @class KeyCodec - binary-comparable encoding of index keys
+ *
+ * A key's columns are encoded one after the other so that comparing two encoded keys with memcmp
+ * (shorter first if one is a prefix of the other) orders them the same as comparing their values
+ * column by column. That lets an index keep keys as plain byte strings, and a key made from just the
+ * leading columns of a composite key is a prefix of the keys it matches. Each column is a byte
+ * saying whether it is NULL (NULLs sort first) followed by, if it isn't:
+ *     INT, BOOLEAN: 4 bytes, big-endian with the sign bit flipped
+ *     TEXT: the characters with each 0x00 written as 0x00 0xff, then 0x00 0x00
+ * An index entry's key can also have the record's handle tacked on (see append_handle), which makes
+ * every entry distinct even when their key values aren't.
+ */
+class KeyCodec {
+public:
+	/**
+	 * Bytes append_handle adds
+	 */
+	static const uint HANDLE_SZ = 6;
+
+	KeyCodec() : data_types() {}
+	explicit KeyCodec(const ColumnAttributes& key_attributes);
+
+	/**
+	 * @returns  number of columns in the key
+	 */
+	uint size() const {return (uint)data_types.size();}
+
+	/**
+	 * @param i      a key column
+	 * @param value  a value to look for
+	 * @returns      true if the value is of the column's type (one that isn't never matches)
+	 */
+	bool accepts(uint i, const Value& value) const {return value.data_type == data_types[i];}
+
+	/**
+	 * Encode the leading key columns that are in the dictionary (all of them for a full key).
+	 * @param key_columns  names of the key columns, in order
+	 * @param key_values   values by column name
+	 * @param key          the encoding is appended to this
+	 * @returns            how many columns were encoded
+	 * @throws             DbRelationError if one of the values isn't of its column's type
+	 */
+	uint encode(const ColumnNames& key_columns, const ValueDict* key_values, std::string& key) const;
+
+	/**
+	 * Encode a whole key.
+	 * @param row    the key's values, field first+i is key column i
+	 * @param key    the encoding is appended to this
+	 * @param first  where in the row the key's values start
+	 * @returns      true if any of the values is NULL
+	 */
+	bool encode(const Row& row, std::string& key, uint first=0) const;
+
+	/**
+	 * Decode a key (as many columns as are there) back into values.
+	 * @param key    the encoded key
+	 * @param size   its size in bytes
+	 * @param row    gets field first+i from key column i
+	 * @param first  where in the row to start
+	 */
+	void decode(const char* key, uint size, Row* row, uint first=0) const;
+
+	/**
+	 * @param key   an encoded key
+	 * @param size  its size in bytes
+	 * @returns     true if any of its values is NULL
+	 */
+	bool has_null(const char* key, uint size) const;
+
+	/**
+	 * Tack a record's handle onto its encoded key.
+	 */
+	static void append_handle(std::string& key, Handle handle);
+
+	/**
+	 * @returns  the handle at the end of an encoded key (see append_handle)
+	 */
+	static Handle get_handle(const char* key, uint size);
+
+protected:
+	std::vector<ColumnAttribute::DataType> data_types;
+
+	void encode(ColumnAttribute::DataType data_type, const Value& value, std::string& key) const;
+	static void encode_int(int32_t n, std::string& key);
+	static void encode_text(const TextView& text, std::string& key);
 };
 
 class DbIndex {
@@ -391,8 +847,10 @@ public:
     static const uint MAX_COMPOSITE = 32U;
 
 	// ctor/dtor
-    DbIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique)
-            : relation(relation), name(name), key_columns(key_columns), unique(unique) {}
+    DbIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique,
+            ColumnNames include_columns=ColumnNames())
+            : relation(relation), name(name), key_columns(key_columns), unique(unique),
+              include_columns(include_columns) {}
     virtual ~DbIndex() {}
 
 	/**
@@ -439,6 +897,15 @@ public:
 	 */
     virtual void insert(Handle record) = 0;
 
+	/**
+	 * Insert the index entries for a batch of records: either all of them go in or, if
+	 * one can't (e.g., a duplicate key in a unique index), none of them do.
+	 * The default inserts one at a time, taking them back out again on failure.
+	 * @param records  handles (into relation) to the records to insert
+	 *                 (all must be in the relation at time of insertion)
+	 */
+    virtual void insert_many(const Handles* records);
+
 	/**
 	 * Delete the index entry for the given record.
 	 * @param record  handle (into relation) to the record to remove
@@ -446,10 +913,50 @@ public:
 	 */
     virtual void del(Handle record) = 0;
 
+	/**
+	 * Accessor for key_columns.
+	 * @returns  the columns of the search key, in order
+	 */
+    virtual const ColumnNames& get_key_columns() const {
+        return key_columns;
+    }
+
+	/**
+	 * Accessor for include_columns.
+	 * @returns  the columns whose values the index keeps with each entry besides the key's (e.g.,
+	 *           so that scan can answer a query from the index alone)
+	 */
+    virtual const ColumnNames& get_include_columns() const {
+        return include_columns;
+    }
+
+	/**
+	 * Can scan answer a query on the given columns (are they all key or included columns)?
+	 * The default is no.
+	 * @param column_names  the columns a query looks at
+	 * @returns             true if scan has all of them
+	 */
+    virtual bool covers(const ColumnNames& column_names) const {
+        return false;
+    }
+
+	/**
+	 * Index-only scan: SELECT <column_names> FROM <relation> WHERE <where>, with the values
+	 * taken from the index's entries instead of from the relation.
+	 * @param where         column = value predicates on covered columns (nullptr for all entries)
+	 * @param column_names  which covered columns, field i of the row is column_names[i]
+	 * @param visit         called for each qualifying entry (the row is only good during the call)
+	 * @throws              DbRelationError if the index can't (see covers)
+	 */
+    virtual void scan(const ValueDict* where, const ColumnNames& column_names, RowVisitor visit) const {
+        throw DbRelationError("index-only scan not supported");
+    }
+
 protected:
     DbRelation& relation;
     Identifier name;
     ColumnNames key_columns;
     bool unique;
+    ColumnNames include_columns;
 };
 